@@ -11,6 +11,27 @@
  * - Custom comparator support
  * - Exception safety and comprehensive error checking
  * - Template-based for all integer types
+ * - Segmented sort of many small independent ranges in one parallel call
+ * - Stable multi-key lexicographic sort via column-wise radix passes
+ * - Indirect sort of large records with in-place cycle-leader permutation
+ * - (key, payload) pair sort on packed 64/128-bit words
+ * - 4-way merge engine that halves the number of passes over memory
+ * - Buffer-free natural merge sort for std::list, std::forward_list and intrusive lists
+ * - Pipelined stdin mode that sorts chunks while input is still being parsed
+ * - Parallel memory-mapped parsing of large text inputs
+ * - Compact binary I/O: raw little-endian integers or delta+varint for sorted data
+ * - External sort with block-compressed spill runs and checkpoint/resume
+ * - O_DIRECT run-file I/O through io_uring, falling back to pread/pwrite
+ * - LRU cache of sorted results keyed by input content and comparator
+ * - Streaming top-k selection in O(k) memory
+ * - Sliding-window order statistics with an order-statistic treap
+ * - Mergeable KLL quantile sketch for approximate percentiles
+ * - Sorted set operations and merge-join with galloping search
+ * - Eytzinger search layout with branchless, prefetching and batched lower bounds
+ * - Non-temporal streaming stores for 4-way merges larger than the last-level cache
+ * - Learned-CDF distribution sort for numeric keys with MergeSort fallback
+ * - Executor abstraction (per-call threads, work-stealing pool, custom schedulers) with seq/par policies
+ * - Per-call and global thread caps, CPU affinity and core-usage reports
  * - Interactive user input demo with repeat option
  * - Professional console output formatting
  */
@@ -25,25 +46,91 @@
 #include <sstream>
 #include <cctype>
 #include <limits>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <chrono>
+#include <random>
+#include <list>
+#include <forward_list>
+#include <iterator>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <typeinfo>
+#include <condition_variable>
+#include <cstdio>
+#include <charconv>
+#include <cerrno>
+#include <fstream>
+#include <filesystem>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define SORTING_POSIX 1
+#endif
+
+#if defined(__SSE2__) && defined(__x86_64__)
+#include <emmintrin.h>
+#define SORTING_STREAM_STORES 1
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#define SORTING_AFFINITY 1
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define SORTING_IO_URING 1
+#endif
+#endif
+#endif
 
 namespace sorting {
 
+template<typename T, typename Comparator>
+class IndirectSort;
+
 /**
  * @class MergeSort
  * @brief Professional implementation of the MergeSort algorithm
+ *
+ * Types larger than kIndirectBytes are sorted through an index array instead (see
+ * IndirectSort), which moves each record once rather than at every merge level; that
+ * path is stable. indirectSort() with a key prefix is faster still.
  */
 template<typename T, typename Comparator = std::less<T>>
 class MergeSort {
 public:
+    static constexpr size_t kIndirectBytes = 64;
+
     static void sort(std::vector<T>& arr, Comparator comp = Comparator()) {
         if (arr.empty()) return;
-        sortImpl(arr.data(), 0, arr.size() - 1, comp);
+        sort(arr.data(), arr.size(), comp);
     }
 
     static void sort(T* arr, size_t size, Comparator comp = Comparator()) {
         if (!arr) throw std::invalid_argument("Null pointer passed to MergeSort::sort");
         if (size <= 1) return;
-        sortImpl(arr, 0, size - 1, comp);
+        if constexpr (sizeof(T) > kIndirectBytes) {
+            IndirectSort<T, Comparator>::sort(arr, size, comp);
+        } else {
+            sortImpl(arr, 0, size - 1, comp);
+        }
     }
 
     static bool isSorted(const T* arr, size_t size, Comparator comp = Comparator()) {
@@ -68,11 +155,8 @@ private:
         const size_t n1 = mid - low + 1;
         const size_t n2 = high - mid;
 
-        std::unique_ptr<T[]> left(new T[n1]);
-        std::unique_ptr<T[]> right(new T[n2]);
-
-        for (size_t i = 0; i < n1; ++i) left[i] = arr[low + i];
-        for (size_t j = 0; j < n2; ++j) right[j] = arr[mid + 1 + j];
+        const std::vector<T> left(arr + low, arr + mid + 1);
+        const std::vector<T> right(arr + mid + 1, arr + high + 1);
 
         size_t i = 0, j = 0, k = low;
         while (i < n1 && j < n2) {
@@ -98,27 +182,5811 @@ void mergeSort(T* arr, size_t size, Comparator comp = Comparator()) {
     MergeSort<T, Comparator>::sort(arr, size, comp);
 }
 
-} // namespace sorting
+namespace detail {
 
 /**
- * @brief Utility functions for demonstration
+ * @brief Exclusive upper bound of the CPU ids a thread can be pinned to
  */
-class MergeSortDemo {
+#if defined(SORTING_AFFINITY)
+inline constexpr int kMaxCpus = CPU_SETSIZE;
+#else
+inline constexpr int kMaxCpus = 1024;
+#endif
+
+/**
+ * @brief CPUs the calling thread may run on; empty where affinity is not supported
+ */
+inline std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#if defined(SORTING_AFFINITY)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < kMaxCpus; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+/**
+ * @brief Hardware threads sharing a physical core with cpu, cpu included, from sysfs
+ */
+inline std::vector<int> coreSiblings(int cpu) {
+    std::vector<int> siblings;
+    std::ifstream list("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+    std::string text;
+    if (std::getline(list, text)) {
+        // Comma-separated CPUs and ranges, e.g. "0,64" or "0-1"
+        std::stringstream ranges(text);
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            const size_t dash = range.find('-');
+            try {
+                const int first = std::stoi(range.substr(0, dash));
+                const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int c = first; c <= last; ++c) siblings.push_back(c);
+            } catch (const std::exception&) {
+                siblings.clear();
+                break;
+            }
+        }
+    }
+    if (std::find(siblings.begin(), siblings.end(), cpu) == siblings.end()) siblings.push_back(cpu);
+    return siblings;
+}
+
+/**
+ * @brief The first CPU of each physical core among cpus, in their order
+ */
+inline std::vector<int> oneCpuPerCore(const std::vector<int>& cpus) {
+    std::vector<int> chosen, covered;
+    for (int cpu : cpus) {
+        if (std::find(covered.begin(), covered.end(), cpu) != covered.end()) continue;
+        chosen.push_back(cpu);
+        for (int sibling : coreSiblings(cpu)) covered.push_back(sibling);
+    }
+    return chosen;
+}
+
+/**
+ * @brief Restricts a thread to cpus; false if that is not supported or fails
+ */
+inline bool pinThread(std::thread::native_handle_type thread, const std::vector<int>& cpus) {
+#if defined(SORTING_AFFINITY)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < kMaxCpus) CPU_SET(cpu, &set);
+    }
+    return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+    (void)thread;
+    (void)cpus;
+    return false;
+#endif
+}
+
+/**
+ * @brief CPU the calling thread is running on, or -1 if unknown
+ */
+inline int currentCpu() {
+#if defined(SORTING_AFFINITY)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+} // namespace detail
+
+/**
+ * @brief How many threads a parallel sort may use and where they may run
+ */
+struct ConcurrencyLimits {
+    size_t maxThreads = 0;      ///< cap on tasks a sort runs at once, the calling thread included; 0: no cap
+    std::vector<int> cpus;      ///< CPUs workers are pinned to; empty: wherever the process may run
+    bool idleSiblings = false;  ///< use one hardware thread per physical core, leaving its siblings idle
+
+    /**
+     * @brief CPUs workers are pinned to after dropping siblings; empty means no pinning
+     */
+    std::vector<int> workerCpus() const {
+        if (cpus.empty() && !idleSiblings) return {};
+        const std::vector<int> base = cpus.empty() ? detail::allowedCpus() : cpus;
+        return idleSiblings ? detail::oneCpuPerCore(base) : base;
+    }
+
+    /**
+     * @brief Threads a sort may run on an executor of the given concurrency
+     */
+    size_t threadsFor(size_t concurrency, const std::vector<int>& pinned) const {
+        size_t threads = std::max<size_t>(1, concurrency);
+        if (maxThreads) threads = std::min(threads, maxThreads);
+        if (!pinned.empty()) threads = std::min(threads, pinned.size());
+        return threads;
+    }
+};
+
+namespace detail {
+
+inline std::mutex& concurrencyLimitsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+inline ConcurrencyLimits& globalConcurrencyLimits() {
+    static ConcurrencyLimits limits;
+    return limits;
+}
+
+} // namespace detail
+
+/**
+ * @brief Limits for every parallel sort not given its own
+ */
+inline void setConcurrencyLimits(const ConcurrencyLimits& limits) {
+    std::lock_guard<std::mutex> lock(detail::concurrencyLimitsMutex());
+    detail::globalConcurrencyLimits() = limits;
+}
+
+inline ConcurrencyLimits concurrencyLimits() {
+    std::lock_guard<std::mutex> lock(detail::concurrencyLimitsMutex());
+    return detail::globalConcurrencyLimits();
+}
+
+/**
+ * @brief Threads and cores a parallel sort ran on
+ */
+struct ParallelSortReport {
+    size_t peakThreads = 0;  ///< most tasks of the sort running at the same time
+    size_t threads = 0;      ///< distinct threads that ran part of the sort, the caller included
+    size_t cores = 0;        ///< distinct CPUs they were seen running on (equals threads where unknown)
+    std::vector<int> cpus;   ///< those CPUs, in the order first seen
+};
+
+namespace detail {
+
+/**
+ * @brief Collects the threads and CPUs that run the tasks of one sort
+ */
+class CoreUsage {
 public:
-    template<typename Container>
-    static void printContainer(const Container& cont) {
-        for (size_t i = 0; i < cont.size(); ++i) {
-            std::cout << cont[i] << (i + 1 == cont.size() ? "" : ", ");
+    /**
+     * @brief Marks the calling thread as running a task of the sort for its lifetime
+     */
+    class Task {
+    public:
+        explicit Task(CoreUsage& usage) : usage_(usage) { usage_.enter(); }
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        ~Task() { usage_.leave(); }
+
+    private:
+        CoreUsage& usage_;
+    };
+
+    ParallelSortReport report() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ParallelSortReport report;
+        report.peakThreads = peak_;
+        report.threads = threads_.size();
+        report.cpus = cpus_;
+        report.cores = cpus_.empty() ? threads_.size() : cpus_.size();
+        return report;
+    }
+
+private:
+    void enter() {
+        const std::thread::id thread = std::this_thread::get_id();
+        const int cpu = currentCpu();
+        std::lock_guard<std::mutex> lock(mutex_);
+        peak_ = std::max(peak_, ++running_);
+        if (std::find(threads_.begin(), threads_.end(), thread) == threads_.end()) threads_.push_back(thread);
+        if (cpu >= 0 && std::find(cpus_.begin(), cpus_.end(), cpu) == cpus_.end()) cpus_.push_back(cpu);
+    }
+
+    void leave() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --running_;
+    }
+
+    mutable std::mutex mutex_;
+    size_t running_ = 0;
+    size_t peak_ = 0;
+    std::vector<std::thread::id> threads_;
+    std::vector<int> cpus_;
+};
+
+/**
+ * @brief Pins the calling thread to cpus and restores its previous affinity on destruction
+ */
+class ScopedAffinity {
+public:
+    explicit ScopedAffinity(const std::vector<int>& cpus) {
+        if (cpus.empty()) return;
+        previous_ = allowedCpus();
+        if (!previous_.empty()) pinThread(pthreadSelf(), cpus);
+    }
+
+    ScopedAffinity(const ScopedAffinity&) = delete;
+    ScopedAffinity& operator=(const ScopedAffinity&) = delete;
+
+    ~ScopedAffinity() {
+        if (!previous_.empty()) pinThread(pthreadSelf(), previous_);
+    }
+
+private:
+    static std::thread::native_handle_type pthreadSelf() {
+#if defined(SORTING_AFFINITY)
+        return pthread_self();
+#else
+        return std::thread::native_handle_type();
+#endif
+    }
+
+    std::vector<int> previous_;
+};
+
+} // namespace detail
+
+/**
+ * @class Executor
+ * @brief Where the parallel engines run their tasks
+ *
+ * Implement submit() on top of an existing scheduler to keep the library from starting
+ * threads of its own. The engines never block an executor thread waiting for other
+ * tasks: the thread that started a parallel operation runs any task the executor has not
+ * started yet, so an operation completes even if the executor is saturated. Tasks do not
+ * throw.
+ */
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    /**
+     * @brief Number of tasks the executor can run at once; engines split work by it
+     */
+    virtual size_t concurrency() const = 0;
+
+    virtual void submit(std::function<void()> task) = 0;
+};
+
+/**
+ * @class ThreadExecutor
+ * @brief Runs every task on a new std::thread, pinned to cpus if given; all of them are
+ * joined on destruction
+ *
+ * Finished threads are only reclaimed by the destructor, so keep a ThreadExecutor for a
+ * single short operation; ThreadPool reuses its threads across tasks.
+ */
+class ThreadExecutor : public Executor {
+public:
+    explicit ThreadExecutor(size_t concurrency = 0, std::vector<int> cpus = {})
+        : concurrency_(concurrency ? concurrency : std::max<size_t>(1, std::thread::hardware_concurrency())),
+          cpus_(std::move(cpus)) {}
+
+    ThreadExecutor(const ThreadExecutor&) = delete;
+    ThreadExecutor& operator=(const ThreadExecutor&) = delete;
+
+    ~ThreadExecutor() override {
+        for (auto& thread : threads_) thread.join();
+    }
+
+    size_t concurrency() const override { return concurrency_; }
+
+    void submit(std::function<void()> task) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.emplace_back(std::move(task));
+        if (!cpus_.empty()) detail::pinThread(threads_.back().native_handle(), cpus_);
+    }
+
+private:
+    const size_t concurrency_;
+    const std::vector<int> cpus_;
+    std::mutex mutex_;
+    std::vector<std::thread> threads_;
+};
+
+/**
+ * @class ThreadPool
+ * @brief Fixed set of worker threads with one task deque each and work stealing
+ *
+ * A task submitted from a worker goes to the back of that worker's deque, which the
+ * worker pops LIFO; other tasks are spread round-robin. Idle workers steal from the
+ * front of the other deques. The destructor runs every queued task before joining.
+ * Workers are pinned to limits.workerCpus(); with threads = 0 the pool sizes itself by
+ * the limits (by default the global ones).
+ */
+class ThreadPool : public Executor {
+public:
+    explicit ThreadPool(size_t threads = 0, const ConcurrencyLimits& limits = concurrencyLimits()) {
+        const std::vector<int> cpus = limits.workerCpus();
+        if (threads == 0) threads = limits.threadsFor(std::thread::hardware_concurrency(), cpus);
+        for (size_t i = 0; i < threads; ++i) queues_.emplace_back(new Queue());
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this, i]() { workerLoop(i); });
+            if (!cpus.empty()) detail::pinThread(workers_.back().native_handle(), cpus);
         }
-        std::cout << "\n";
     }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() override {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) worker.join();
+    }
+
+    size_t concurrency() const override { return workers_.size(); }
+
+    void submit(std::function<void()> task) override {
+        const size_t target = currentPool_ == this ? currentWorker_ : nextQueue_++ % queues_.size();
+        // Counted before it is pushed, so a worker taking it never sees the count at zero
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            ++queued_;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+            queues_[target]->tasks.push_back(std::move(task));
+        }
+        wake_.notify_one();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(size_t self) {
+        currentPool_ = this;
+        currentWorker_ = self;
+        for (;;) {
+            std::function<void()> task;
+            if (take(self, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            wake_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+            if (stopping_ && queued_ == 0) return;
+        }
+    }
+
+    bool take(size_t self, std::function<void()>& task) {
+        for (size_t k = 0; k < queues_.size(); ++k) {
+            Queue& queue = *queues_[(self + k) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            if (k == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> sleepLock(sleepMutex_);
+            --queued_;
+            return true;
+        }
+        return false;
+    }
+
+    inline static thread_local ThreadPool* currentPool_ = nullptr;
+    inline static thread_local size_t currentWorker_ = 0;
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> nextQueue_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    size_t queued_ = 0;  ///< tasks in all deques, guarded by sleepMutex_
+    bool stopping_ = false;
 };
 
+namespace detail {
+
+inline std::atomic<Executor*>& defaultExecutorSlot() {
+    static std::atomic<Executor*> slot(nullptr);
+    return slot;
+}
+
+} // namespace detail
+
 /**
- * @brief Main function with interactive user input + professional demo
+ * @brief Routes every parallel engine that is not given an executor to this one;
+ * nullptr (the default) lets them start their own threads
  */
-int main() {
-    try {
+inline void setDefaultExecutor(Executor* executor) {
+    detail::defaultExecutorSlot().store(executor);
+}
+
+inline Executor* defaultExecutor() {
+    return detail::defaultExecutorSlot().load();
+}
+
+namespace execution {
+
+/**
+ * @brief Sort on the calling thread
+ */
+struct SequencedPolicy {};
+
+/**
+ * @brief Sort on an executor: the one given with on(), else the default executor, else
+ * threads started for the call; within the limits given with with(), else the global ones
+ */
+struct ParallelPolicy {
+    Executor* executor = nullptr;
+    const ConcurrencyLimits* limits = nullptr;  ///< must outlive the sort call
+
+    ParallelPolicy on(Executor& target) const {
+        ParallelPolicy policy = *this;
+        policy.executor = &target;
+        return policy;
+    }
+
+    ParallelPolicy with(const ConcurrencyLimits& target) const {
+        ParallelPolicy policy = *this;
+        policy.limits = &target;
+        return policy;
+    }
+};
+
+inline constexpr SequencedPolicy seq{};
+inline constexpr ParallelPolicy par{};
+
+} // namespace execution
+
+namespace detail {
+
+/**
+ * @brief Calls fn(executor, threads) with executor, or the default executor, or a
+ * ThreadPool that lives for the call, and the number of threads limits allow on it.
+ * The pool's workers serve every parallel step of the call, so a multi-level sort does
+ * not start (and keep) new threads per level. With pinned CPUs the calling thread, which
+ * helps with the work, is pinned for the call.
+ */
+template<typename Fn>
+void withExecutor(Executor* executor, const ConcurrencyLimits& limits, Fn fn) {
+    const std::vector<int> cpus = limits.workerCpus();
+    ScopedAffinity pinCaller(cpus);
+    if (!executor) executor = defaultExecutor();
+    if (executor) {
+        fn(*executor, limits.threadsFor(executor->concurrency(), cpus));
+        return;
+    }
+    const size_t threads = limits.threadsFor(std::thread::hardware_concurrency(), cpus);
+    if (threads <= 1) {
+        // One thread is the caller; an executor that never gets a task starts no thread
+        ThreadExecutor callerOnly(1, cpus);
+        fn(callerOnly, size_t(1));
+        return;
+    }
+    ThreadPool pool(threads, limits);
+    fn(pool, threads);
+}
+
+/**
+ * @class TaskGroup
+ * @brief Jobs run on an executor, with the waiting thread helping
+ *
+ * run() queues a job and submits a token to the executor that runs one queued job.
+ * wait() runs queued jobs on the calling thread until none are left, then waits for the
+ * jobs already started, so a group finishes even if the executor never gets to its
+ * tokens. Tokens that run late find the queue empty and only touch the state they keep
+ * alive. The first exception thrown by a job is rethrown by wait().
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(Executor& executor) : executor_(executor), state_(std::make_shared<State>()) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup() {
+        try {
+            wait();
+        } catch (...) {
+        }
+    }
+
+    void run(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            state_->queue.push_back(std::move(job));
+        }
+        std::shared_ptr<State> state = state_;
+        executor_.submit([state]() { runOne(*state); });
+    }
+
+    /**
+     * @brief Runs one queued job on the calling thread; false if none was queued
+     */
+    bool runOne() { return runOne(*state_); }
+
+    void wait() {
+        for (;;) {
+            while (runOne(*state_)) {
+            }
+            std::unique_lock<std::mutex> lock(state_->mutex);
+            state_->idle.wait(lock, [this]() { return state_->running == 0 || !state_->queue.empty(); });
+            if (state_->running == 0 && state_->queue.empty()) break;
+        }
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->error) std::rethrow_exception(std::exchange(state_->error, nullptr));
+    }
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable idle;
+        std::deque<std::function<void()>> queue;
+        size_t running = 0;
+        std::exception_ptr error;
+    };
+
+    static bool runOne(State& state) {
+        std::function<void()> job;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (state.queue.empty()) return false;
+            job = std::move(state.queue.front());
+            state.queue.pop_front();
+            ++state.running;
+        }
+        try {
+            job();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.error) state.error = std::current_exception();
+        }
+        job = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            --state.running;
+        }
+        state.idle.notify_all();
+        return true;
+    }
+
+    Executor& executor_;
+    std::shared_ptr<State> state_;
+};
+
+} // namespace detail
+
+namespace detail {
+
+/**
+ * @brief Runs fn(i) for every i in [0, count) on up to executor.concurrency() tasks, or
+ * maxWorkers if that is lower
+ *
+ * Indices are handed out dynamically, so uneven task sizes still balance, and the calling
+ * thread works through them as well. The first exception thrown by fn is rethrown on the
+ * calling thread after every started task has finished.
+ */
+template<typename Fn>
+void parallelFor(Executor& executor, size_t count, Fn fn, size_t maxWorkers = 0) {
+    size_t workers = std::min(std::max<size_t>(1, executor.concurrency()), count);
+    if (maxWorkers) workers = std::min(workers, maxWorkers);
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        try {
+            for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) fn(i);
+        } catch (...) {
+            next.store(count);
+            throw;
+        }
+    };
+    TaskGroup group(executor);
+    for (size_t t = 1; t < workers; ++t) group.run(worker);
+    worker();
+    group.wait();
+}
+
+/**
+ * @brief parallelFor on the default executor, or on threads started for the call, within
+ * the global concurrency limits
+ */
+template<typename Fn>
+void parallelFor(size_t count, Fn fn) {
+    withExecutor(nullptr, concurrencyLimits(), [&](Executor& executor, size_t threads) {
+        parallelFor(executor, count, fn, threads);
+    });
+}
+
+template<typename T, typename Comparator>
+inline void compareExchange(T& a, T& b, Comparator& comp) {
+    if (comp(b, a)) std::swap(a, b);
+}
+
+/**
+ * @brief Optimal sorting networks for 2 to 4 elements
+ */
+template<typename T, typename Comparator>
+void sortNetwork(T* a, size_t n, Comparator& comp) {
+    switch (n) {
+    case 2:
+        compareExchange(a[0], a[1], comp);
+        break;
+    case 3:
+        compareExchange(a[0], a[1], comp);
+        compareExchange(a[1], a[2], comp);
+        compareExchange(a[0], a[1], comp);
+        break;
+    case 4:
+        compareExchange(a[0], a[1], comp);
+        compareExchange(a[2], a[3], comp);
+        compareExchange(a[0], a[2], comp);
+        compareExchange(a[1], a[3], comp);
+        compareExchange(a[1], a[2], comp);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Size of the last-level cache in bytes, or a conservative default if unknown
+ */
+inline size_t lastLevelCacheBytes() {
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+    const long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (l3 > 0) return static_cast<size_t>(l3);
+#endif
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    const long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 > 0) return static_cast<size_t>(l2);
+#endif
+    return size_t(32) << 20;
+}
+
+/**
+ * @brief Stores value at dst with a non-temporal hint where T is 4 bytes or a multiple of
+ * 8 bytes and trivially copyable (x86-64 MOVNTI); a plain store otherwise
+ *
+ * Streamed lines bypass the cache hierarchy, so writing a large output does not evict
+ * data other code is still using. streamFence() orders them before later stores.
+ */
+template<typename T>
+inline void streamStore(T* dst, T&& value) {
+#if defined(SORTING_STREAM_STORES)
+    if constexpr (std::is_trivially_copyable<T>::value && sizeof(T) % 8 == 0) {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        long long* words = reinterpret_cast<long long*>(dst);
+        for (size_t i = 0; i < sizeof(T) / 8; ++i) {
+            long long word;
+            std::memcpy(&word, bytes + 8 * i, 8);
+            _mm_stream_si64(words + i, word);
+        }
+        return;
+    } else if constexpr (std::is_trivially_copyable<T>::value && sizeof(T) == 4) {
+        int word;
+        std::memcpy(&word, &value, 4);
+        _mm_stream_si32(reinterpret_cast<int*>(dst), word);
+        return;
+    }
+#endif
+    *dst = std::move(value);
+}
+
+template<typename T>
+constexpr bool canStreamStore() {
+#if defined(SORTING_STREAM_STORES)
+    return std::is_trivially_copyable<T>::value && (sizeof(T) % 8 == 0 || sizeof(T) == 4);
+#else
+    return false;
+#endif
+}
+
+inline void streamFence() {
+#if defined(SORTING_STREAM_STORES)
+    _mm_sfence();
+#endif
+}
+
+template<typename T, typename Comparator>
+void insertionSort(T* a, size_t n, Comparator& comp) {
+    for (size_t i = 1; i < n; ++i) {
+        if (!comp(a[i], a[i - 1])) continue;
+        T value = std::move(a[i]);
+        size_t j = i;
+        do {
+            a[j] = std::move(a[j - 1]);
+            --j;
+        } while (j > 0 && comp(value, a[j - 1]));
+        a[j] = std::move(value);
+    }
+}
+
+} // namespace detail
+
+namespace detail {
+
+/**
+ * @brief Storage for size values of T that starts out unconstructed, so T need not be
+ * default constructible; the values are destroyed only after markConstructed()
+ */
+template<typename T>
+class RawBuffer {
+public:
+    explicit RawBuffer(size_t size) : data_(std::allocator<T>().allocate(size)), size_(size) {}
+
+    RawBuffer(const RawBuffer&) = delete;
+    RawBuffer& operator=(const RawBuffer&) = delete;
+
+    ~RawBuffer() {
+        if (constructed_) std::destroy_n(data_, size_);
+        std::allocator<T>().deallocate(data_, size_);
+    }
+
+    T* get() const { return data_; }
+    size_t bytes() const { return size_ * sizeof(T); }
+    void markConstructed() { constructed_ = true; }
+
+private:
+    T* data_;
+    size_t size_;
+    bool constructed_ = false;
+};
+
+/**
+ * @brief Stable merge of [a, aEnd) and [b, bEnd) to out, moving the values; with
+ * Construct, out is unconstructed memory and on an exception the values constructed so
+ * far are destroyed
+ */
+template<bool Construct, typename T, typename Comparator>
+void mergeMove(T* a, T* aEnd, T* b, T* bEnd, T* out, Comparator& comp) {
+    T* const first = out;
+    auto put = [](T* to, T& value) {
+        if constexpr (Construct) {
+            ::new (static_cast<void*>(to)) T(std::move(value));
+        } else {
+            *to = std::move(value);
+        }
+    };
+    try {
+        for (; a != aEnd && b != bEnd; ++out) put(out, comp(*b, *a) ? *b++ : *a++);
+        for (; a != aEnd; ++out) put(out, *a++);
+        for (; b != bEnd; ++out) put(out, *b++);
+    } catch (...) {
+        if constexpr (Construct) std::destroy(first, out);
+        throw;
+    }
+}
+
+/**
+ * @brief Number of elements of a among the first d outputs of a stable merge of a and b
+ */
+template<typename T, typename Comparator>
+size_t mergePathSplit(const T* a, size_t na, const T* b, size_t nb, size_t d, Comparator& comp) {
+    size_t lo = d > nb ? d - nb : 0;
+    size_t hi = std::min(d, na);
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (comp(b[d - mid - 1], a[mid])) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+} // namespace detail
+
+/**
+ * @class ParallelMergeSort
+ * @brief MergeSort across an executor: blocks sorted concurrently, then merged pairwise
+ *
+ * Every level's merges are cut into pieces of equal output size along merge-path
+ * diagonals, so the last levels, with only a few runs left, still keep all tasks busy.
+ * Merges take the left run on ties, but blocks are sorted by MergeSort, so like
+ * MergeSort the result is not stable.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class ParallelMergeSort {
+public:
+    static constexpr size_t kMinBlock = size_t(1) << 13;
+
+    /**
+     * @brief Sorts on at most maxThreads threads of executor (0: its full concurrency)
+     */
+    static ParallelSortReport sort(Executor& executor, T* arr, size_t size, Comparator comp = Comparator(),
+                                   size_t maxThreads = 0) {
+        detail::CoreUsage usage;
+        size_t tasks = std::min(executor.concurrency(), size / kMinBlock);
+        if (maxThreads) tasks = std::min(tasks, maxThreads);
+        if (tasks <= 1) {
+            const detail::CoreUsage::Task task(usage);
+            MergeSort<T, Comparator>::sort(arr, size, comp);
+            return usage.report();
+        }
+
+        std::vector<size_t> bounds(tasks + 1);
+        for (size_t b = 0; b <= tasks; ++b) bounds[b] = size * b / tasks;
+        detail::parallelFor(executor, tasks, [&](size_t b) {
+            const detail::CoreUsage::Task task(usage);
+            MergeSort<T, Comparator>::sort(arr + bounds[b], bounds[b + 1] - bounds[b], comp);
+        }, tasks);
+
+        struct Piece {
+            size_t lo, mid, hi;  ///< runs [lo, mid) and [mid, hi) of src
+            size_t first, last;  ///< output diagonals of this piece
+        };
+        // The first level constructs every value of the buffer; later levels assign
+        detail::RawBuffer<T> buffer(size);
+        T* src = arr;
+        T* dst = buffer.get();
+        for (bool constructed = false; bounds.size() > 2; constructed = true) {
+            std::vector<size_t> merged;
+            std::vector<Piece> pieces;
+            for (size_t r = 0; r + 1 < bounds.size(); r += 2) {
+                const size_t lo = bounds[r], mid = bounds[r + 1];
+                const size_t hi = r + 2 < bounds.size() ? bounds[r + 2] : mid;
+                merged.push_back(lo);
+                const size_t parts = std::max<size_t>(1, (hi - lo) * tasks / size);
+                for (size_t p = 0; p < parts; ++p) {
+                    pieces.push_back({lo, mid, hi, (hi - lo) * p / parts, (hi - lo) * (p + 1) / parts});
+                }
+            }
+            merged.push_back(size);
+            std::vector<char> done(pieces.size(), 0);
+            try {
+                detail::parallelFor(executor, pieces.size(), [&](size_t i) {
+                    const detail::CoreUsage::Task task(usage);
+                    const Piece& piece = pieces[i];
+                    Comparator localComp = comp;
+                    T* a = src + piece.lo;
+                    T* b = src + piece.mid;
+                    const size_t na = piece.mid - piece.lo, nb = piece.hi - piece.mid;
+                    const size_t i0 = detail::mergePathSplit(a, na, b, nb, piece.first, localComp);
+                    const size_t i1 = detail::mergePathSplit(a, na, b, nb, piece.last, localComp);
+                    T* out = dst + piece.lo + piece.first;
+                    if (constructed) {
+                        detail::mergeMove<false>(a + i0, a + i1, b + (piece.first - i0), b + (piece.last - i1), out,
+                                                 localComp);
+                    } else {
+                        detail::mergeMove<true>(a + i0, a + i1, b + (piece.first - i0), b + (piece.last - i1), out,
+                                                localComp);
+                        done[i] = 1;
+                    }
+                }, tasks);
+            } catch (...) {
+                // Pieces of the first level that finished hold the only constructed values
+                for (size_t i = 0; i < pieces.size(); ++i) {
+                    if (!constructed && done[i]) {
+                        std::destroy(dst + pieces[i].lo + pieces[i].first, dst + pieces[i].lo + pieces[i].last);
+                    }
+                }
+                throw;
+            }
+            if (!constructed) buffer.markConstructed();
+            std::swap(src, dst);
+            bounds.swap(merged);
+        }
+        if (src != arr) {
+            detail::parallelFor(executor, tasks, [&](size_t b) {
+                std::move(src + size * b / tasks, src + size * (b + 1) / tasks, arr + size * b / tasks);
+            }, tasks);
+        }
+        return usage.report();
+    }
+};
+
+template<typename T, typename Comparator = std::less<T>>
+void mergeSort(execution::SequencedPolicy, std::vector<T>& arr, Comparator comp = Comparator()) {
+    MergeSort<T, Comparator>::sort(arr, comp);
+}
+
+template<typename T, typename Comparator = std::less<T>>
+void mergeSort(execution::SequencedPolicy, T* arr, size_t size, Comparator comp = Comparator()) {
+    MergeSort<T, Comparator>::sort(arr, size, comp);
+}
+
+template<typename T, typename Comparator = std::less<T>>
+ParallelSortReport mergeSort(const execution::ParallelPolicy& policy, T* arr, size_t size,
+                             Comparator comp = Comparator()) {
+    if (!arr) throw std::invalid_argument("Null pointer passed to mergeSort");
+    ParallelSortReport report;
+    detail::withExecutor(policy.executor, policy.limits ? *policy.limits : concurrencyLimits(),
+                         [&](Executor& executor, size_t threads) {
+        report = ParallelMergeSort<T, Comparator>::sort(executor, arr, size, comp, threads);
+    });
+    return report;
+}
+
+template<typename T, typename Comparator = std::less<T>>
+ParallelSortReport mergeSort(const execution::ParallelPolicy& policy, std::vector<T>& arr,
+                             Comparator comp = Comparator()) {
+    if (arr.empty()) return ParallelSortReport();
+    return mergeSort(policy, arr.data(), arr.size(), comp);
+}
+
+/**
+ * @class SegmentedSort
+ * @brief Sorts many independent segments of one array in a single call
+ *
+ * Segment i is the range [offsets[i], offsets[i + 1]). Each segment is sorted with a
+ * strategy picked by its size (sorting network, insertion sort or MergeSort), and
+ * consecutive segments are grouped into blocks that are sorted in parallel.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class SegmentedSort {
+public:
+    static constexpr size_t kNetworkMax = 4;
+    static constexpr size_t kInsertionMax = 32;
+    static constexpr size_t kBlockElements = size_t(1) << 14;
+
+    static void sort(std::vector<T>& values, const std::vector<size_t>& offsets,
+                     Comparator comp = Comparator()) {
+        validate(offsets, values.size());
+        if (offsets.size() < 2) return;
+
+        // Group consecutive segments into blocks of roughly kBlockElements each
+        std::vector<size_t> blocks;
+        blocks.push_back(0);
+        size_t pending = 0;
+        for (size_t s = 0; s + 1 < offsets.size(); ++s) {
+            pending += offsets[s + 1] - offsets[s];
+            if (pending >= kBlockElements) {
+                blocks.push_back(s + 1);
+                pending = 0;
+            }
+        }
+        const size_t segments = offsets.size() - 1;
+        if (blocks.back() != segments) blocks.push_back(segments);
+
+        T* data = values.data();
+        detail::parallelFor(blocks.size() - 1, [&](size_t b) {
+            Comparator localComp = comp;
+            for (size_t s = blocks[b]; s < blocks[b + 1]; ++s) {
+                sortSegment(data + offsets[s], offsets[s + 1] - offsets[s], localComp);
+            }
+        });
+    }
+
+private:
+    static void validate(const std::vector<size_t>& offsets, size_t size) {
+        for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+            if (offsets[i] > offsets[i + 1]) {
+                throw std::invalid_argument("Segment offsets must be non-decreasing");
+            }
+        }
+        if (!offsets.empty() && offsets.back() > size) {
+            throw std::out_of_range("Segment offset exceeds the number of values");
+        }
+    }
+
+    static void sortSegment(T* first, size_t size, Comparator& comp) {
+        if (size <= 1) return;
+        if (size <= kNetworkMax) {
+            detail::sortNetwork(first, size, comp);
+        } else if (size <= kInsertionMax) {
+            detail::insertionSort(first, size, comp);
+        } else {
+            MergeSort<T, Comparator>::sort(first, size, comp);
+        }
+    }
+};
+
+template<typename T, typename Comparator = std::less<T>>
+void segmentedSort(std::vector<T>& values, const std::vector<size_t>& offsets,
+                   Comparator comp = Comparator()) {
+    SegmentedSort<T, Comparator>::sort(values, offsets, comp);
+}
+
+enum class SortOrder { Ascending, Descending };
+
+namespace detail {
+
+/**
+ * @brief Maps a numeric key to 64 bits whose unsigned order matches the key's order
+ */
+template<typename K>
+uint64_t orderedBits(K key) {
+    static_assert(std::is_arithmetic<K>::value, "Sort keys must be arithmetic types");
+    constexpr uint64_t kSignBit = uint64_t(1) << 63;
+    if constexpr (std::is_floating_point<K>::value) {
+        const double wide = static_cast<double>(key);
+        uint64_t bits;
+        std::memcpy(&bits, &wide, sizeof(bits));
+        return (bits & kSignBit) ? ~bits : (bits | kSignBit);
+    } else if constexpr (std::is_signed<K>::value) {
+        return static_cast<uint64_t>(static_cast<int64_t>(key)) ^ kSignBit;
+    } else {
+        return static_cast<uint64_t>(key);
+    }
+}
+
+/**
+ * @brief Inverse of orderedBits for integral keys
+ */
+template<typename K>
+K fromOrderedBits(uint64_t bits) {
+    static_assert(std::is_integral<K>::value, "fromOrderedBits supports integral keys only");
+    if constexpr (std::is_signed<K>::value) {
+        return static_cast<K>(static_cast<int64_t>(bits ^ (uint64_t(1) << 63)));
+    } else {
+        return static_cast<K>(bits);
+    }
+}
+
+/**
+ * @brief Maps a numeric key to its own width in bits (8 * sizeof(K)) with unsigned order
+ * matching the key's order; unlike orderedBits, floats stay 32 bits wide
+ */
+template<typename K>
+uint64_t orderedKeyBits(K key) {
+    static_assert(std::is_arithmetic<K>::value, "Sort keys must be arithmetic types");
+    constexpr unsigned kBits = 8 * sizeof(K);
+    constexpr uint64_t kSignBit = uint64_t(1) << (kBits - 1);
+    constexpr uint64_t kMask = kBits == 64 ? ~uint64_t(0) : (uint64_t(1) << kBits) - 1;
+    if constexpr (std::is_floating_point<K>::value) {
+        static_assert(sizeof(K) == 4 || sizeof(K) == 8, "Floating-point keys must be 32 or 64 bits");
+        using Bits = typename std::conditional<sizeof(K) == 4, uint32_t, uint64_t>::type;
+        Bits raw;
+        std::memcpy(&raw, &key, sizeof(raw));
+        const uint64_t bits = raw;
+        return ((bits & kSignBit) ? ~bits : (bits | kSignBit)) & kMask;
+    } else if constexpr (std::is_signed<K>::value) {
+        return (static_cast<uint64_t>(static_cast<int64_t>(key)) ^ kSignBit) & kMask;
+    } else {
+        return static_cast<uint64_t>(key);
+    }
+}
+
+/**
+ * @brief Inverse of orderedKeyBits, exact for every key including floats
+ */
+template<typename K>
+K keyFromOrderedBits(uint64_t bits) {
+    constexpr unsigned kBits = 8 * sizeof(K);
+    constexpr uint64_t kSignBit = uint64_t(1) << (kBits - 1);
+    constexpr uint64_t kMask = kBits == 64 ? ~uint64_t(0) : (uint64_t(1) << kBits) - 1;
+    if constexpr (std::is_floating_point<K>::value) {
+        using Bits = typename std::conditional<sizeof(K) == 4, uint32_t, uint64_t>::type;
+        const Bits raw = static_cast<Bits>(((bits & kSignBit) ? (bits ^ kSignBit) : ~bits) & kMask);
+        K key;
+        std::memcpy(&key, &raw, sizeof(key));
+        return key;
+    } else if constexpr (std::is_signed<K>::value) {
+        using Unsigned = typename std::make_unsigned<K>::type;
+        return static_cast<K>(static_cast<Unsigned>(bits ^ kSignBit));
+    } else {
+        return static_cast<K>(bits);
+    }
+}
+
+template<size_t Bytes> struct UnsignedOfSize {
+    static_assert(Bytes == 1 || Bytes == 2 || Bytes == 4 || Bytes == 8, "Packed fields must be 1, 2, 4 or 8 bytes");
+};
+template<> struct UnsignedOfSize<1> { using type = uint8_t; };
+template<> struct UnsignedOfSize<2> { using type = uint16_t; };
+template<> struct UnsignedOfSize<4> { using type = uint32_t; };
+template<> struct UnsignedOfSize<8> { using type = uint64_t; };
+
+/**
+ * @brief 128-bit sort word: hi is compared first
+ */
+struct Word128 {
+    uint64_t hi;
+    uint64_t lo;
+};
+
+inline unsigned wordByte(uint64_t word, unsigned byte) {
+    return static_cast<unsigned>(word >> (8 * byte)) & 0xFF;
+}
+
+inline unsigned wordByte(const Word128& word, unsigned byte) {
+    return byte < 8 ? wordByte(word.lo, byte) : wordByte(word.hi, byte - 8);
+}
+
+/**
+ * @brief Stable LSD radix sort of plain words on bytes [firstByte, lastByte)
+ *
+ * Same scheme as radixSortPairs: one histogram pass for all bytes, and passes whose
+ * byte is identical for every word are skipped.
+ */
+template<typename Word>
+void radixSortWords(std::vector<Word>& words, std::vector<Word>& scratch, unsigned firstByte, unsigned lastByte) {
+    const size_t n = words.size();
+    if (n <= 1 || firstByte >= lastByte) return;
+    scratch.resize(n);
+
+    const unsigned passes = lastByte - firstByte;
+    std::vector<size_t> counts(passes * 256, 0);
+    for (const Word& word : words) {
+        for (unsigned p = 0; p < passes; ++p) ++counts[p * 256 + wordByte(word, firstByte + p)];
+    }
+
+    for (unsigned p = 0; p < passes; ++p) {
+        size_t* bucket = &counts[p * 256];
+        const unsigned byte = firstByte + p;
+        if (bucket[wordByte(words[0], byte)] == n) continue;
+
+        size_t sum = 0;
+        for (unsigned b = 0; b < 256; ++b) {
+            const size_t c = bucket[b];
+            bucket[b] = sum;
+            sum += c;
+        }
+        for (const Word& word : words) scratch[bucket[wordByte(word, byte)]++] = word;
+        words.swap(scratch);
+    }
+}
+
+struct KeyIndex {
+    uint64_t key;
+    size_t index;
+};
+
+/**
+ * @brief Stable LSD radix sort of (key, index) pairs by key, one byte per pass
+ *
+ * All eight byte histograms are built in a single read pass, and passes whose byte
+ * is identical for every item are skipped.
+ */
+inline void radixSortPairs(std::vector<KeyIndex>& items, std::vector<KeyIndex>& scratch) {
+    const size_t n = items.size();
+    if (n <= 1) return;
+    scratch.resize(n);
+
+    std::vector<size_t> counts(8 * 256, 0);
+    for (const KeyIndex& item : items) {
+        for (unsigned byte = 0; byte < 8; ++byte) {
+            ++counts[byte * 256 + ((item.key >> (8 * byte)) & 0xFF)];
+        }
+    }
+
+    for (unsigned byte = 0; byte < 8; ++byte) {
+        size_t* bucket = &counts[byte * 256];
+        if (bucket[(items[0].key >> (8 * byte)) & 0xFF] == n) continue;
+
+        size_t sum = 0;
+        for (unsigned b = 0; b < 256; ++b) {
+            const size_t c = bucket[b];
+            bucket[b] = sum;
+            sum += c;
+        }
+        for (const KeyIndex& item : items) {
+            scratch[bucket[(item.key >> (8 * byte)) & 0xFF]++] = item;
+        }
+        items.swap(scratch);
+    }
+}
+
+} // namespace detail
+
+/**
+ * @class MultiKeySort
+ * @brief Stable lexicographic sort of records by several numeric key columns
+ *
+ * Keys are added from most to least significant, each with its own direction. The sort
+ * runs column-wise from the least significant key, radix-sorting normalized key bits,
+ * so no comparison ever re-examines an earlier key field.
+ */
+template<typename T>
+class MultiKeySort {
+public:
+    template<typename Extractor>
+    MultiKeySort& addKey(Extractor extractor, SortOrder order = SortOrder::Ascending) {
+        using Key = typename std::decay<decltype(extractor(std::declval<const T&>()))>::type;
+        const bool descending = order == SortOrder::Descending;
+        keys_.push_back([extractor, descending](const T& record) {
+            const uint64_t bits = detail::orderedBits<Key>(extractor(record));
+            return descending ? ~bits : bits;
+        });
+        return *this;
+    }
+
+    size_t keyCount() const { return keys_.size(); }
+
+    void sort(std::vector<T>& records) const {
+        if (keys_.empty()) throw std::logic_error("MultiKeySort::sort called without any keys");
+        const size_t n = records.size();
+        if (n <= 1) return;
+
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; ++i) order[i] = i;
+
+        std::vector<detail::KeyIndex> items(n);
+        std::vector<detail::KeyIndex> scratch;
+        for (size_t k = keys_.size(); k-- > 0;) {
+            for (size_t i = 0; i < n; ++i) items[i] = {keys_[k](records[order[i]]), order[i]};
+            detail::radixSortPairs(items, scratch);
+            for (size_t i = 0; i < n; ++i) order[i] = items[i].index;
+        }
+
+        std::vector<T> sorted;
+        sorted.reserve(n);
+        for (size_t i = 0; i < n; ++i) sorted.push_back(std::move(records[order[i]]));
+        records.swap(sorted);
+    }
+
+private:
+    std::vector<std::function<uint64_t(const T&)>> keys_;
+};
+
+/**
+ * @brief How merges write their output
+ */
+enum class StoreHint {
+    Cached,    ///< ordinary stores
+    Streaming  ///< non-temporal stores for merges whose output is larger than the LLC
+};
+
+/**
+ * @class QuadMergeSort
+ * @brief Bottom-up stable merge sort that merges four runs per pass
+ *
+ * Merging four runs at a time halves the number of full passes over memory compared
+ * with a 2-way merge. The 4-way merge is a two-level tournament that caches the winner
+ * of each pair, so each output element costs two comparisons and index selection is
+ * written as conditional moves rather than branches. With StoreHint::Streaming, merges
+ * whose output exceeds the last-level cache write it with non-temporal stores, since
+ * the next pass will not read it back before it would be evicted anyway.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class QuadMergeSort {
+public:
+    static constexpr size_t kRunSize = 32;
+
+    static void sort(std::vector<T>& arr, Comparator comp = Comparator(), StoreHint hint = StoreHint::Cached) {
+        if (arr.empty()) return;
+        sort(arr.data(), arr.size(), comp, hint);
+    }
+
+    static void sort(T* arr, size_t size, Comparator comp = Comparator(), StoreHint hint = StoreHint::Cached) {
+        if (!arr) throw std::invalid_argument("Null pointer passed to QuadMergeSort::sort");
+        if (size <= 1) return;
+
+        for (size_t start = 0; start < size; start += kRunSize) {
+            detail::insertionSort(arr + start, std::min(kRunSize, size - start), comp);
+        }
+        if (size <= kRunSize) return;
+
+        // Merges with more output elements than this stream it
+        const size_t streamAbove = hint == StoreHint::Streaming && detail::canStreamStore<T>()
+                                       ? detail::lastLevelCacheBytes() / sizeof(T)
+                                       : std::numeric_limits<size_t>::max();
+        std::unique_ptr<T[]> buffer(new T[size]);
+        T* src = arr;
+        T* dst = buffer.get();
+        for (size_t width = kRunSize; width < size; width *= 4) {
+            for (size_t start = 0; start < size; start += 4 * width) {
+                T* begins[4];
+                T* ends[4];
+                for (size_t r = 0; r < 4; ++r) {
+                    begins[r] = src + std::min(size, start + r * width);
+                    ends[r] = src + std::min(size, start + (r + 1) * width);
+                }
+                if (std::min(size - start, 4 * width) > streamAbove) {
+                    merge4<true>(begins, ends, dst + start, comp);
+                } else {
+                    merge4<false>(begins, ends, dst + start, comp);
+                }
+            }
+            std::swap(src, dst);
+        }
+        if (src != arr) {
+            if (size > streamAbove) {
+                for (size_t i = 0; i < size; ++i) detail::streamStore(arr + i, std::move(src[i]));
+            } else {
+                std::move(src, src + size, arr);
+            }
+        }
+        if (size > streamAbove) detail::streamFence();
+    }
+
+    /**
+     * @brief Number of full passes over the data for an input of the given size
+     */
+    static size_t passCount(size_t size) {
+        size_t passes = 0;
+        for (size_t width = kRunSize; width < size; width *= 4) ++passes;
+        return passes;
+    }
+
+private:
+    template<bool Stream>
+    static void put(T* out, T&& value) {
+        if constexpr (Stream) {
+            detail::streamStore(out, std::move(value));
+        } else {
+            *out = std::move(value);
+        }
+    }
+
+    template<bool Stream>
+    static void merge4(T** p, T** e, T* out, Comparator& comp) {
+        if (p[0] < e[0] && p[1] < e[1] && p[2] < e[2] && p[3] < e[3]) {
+            size_t winAB = comp(*p[1], *p[0]) ? 1 : 0;
+            size_t winCD = comp(*p[3], *p[2]) ? 3 : 2;
+            for (;;) {
+                const size_t w = comp(*p[winCD], *p[winAB]) ? winCD : winAB;
+                put<Stream>(out++, std::move(*p[w]++));
+                if (p[w] == e[w]) break;
+                if (w < 2) {
+                    winAB = comp(*p[1], *p[0]) ? 1 : 0;
+                } else {
+                    winCD = comp(*p[3], *p[2]) ? 3 : 2;
+                }
+            }
+        }
+
+        // Tail: at most three runs remain, merged by a plain minimum scan
+        size_t active = 0;
+        for (size_t r = 0; r < 4; ++r) {
+            if (p[r] < e[r]) {
+                p[active] = p[r];
+                e[active] = e[r];
+                ++active;
+            }
+        }
+        while (active > 1) {
+            size_t w = 0;
+            for (size_t r = 1; r < active; ++r) {
+                if (comp(*p[r], *p[w])) w = r;
+            }
+            put<Stream>(out++, std::move(*p[w]++));
+            if (p[w] == e[w]) {
+                for (size_t r = w + 1; r < active; ++r) {
+                    p[r - 1] = p[r];
+                    e[r - 1] = e[r];
+                }
+                --active;
+            }
+        }
+        if (active == 1) {
+            if constexpr (Stream) {
+                while (p[0] < e[0]) put<Stream>(out++, std::move(*p[0]++));
+            } else {
+                std::move(p[0], e[0], out);
+            }
+        }
+    }
+};
+
+template<typename T, typename Comparator = std::less<T>>
+void quadMergeSort(std::vector<T>& arr, Comparator comp = Comparator(), StoreHint hint = StoreHint::Cached) {
+    QuadMergeSort<T, Comparator>::sort(arr, comp, hint);
+}
+
+namespace detail {
+
+/**
+ * @brief Reorders arr so that arr[i] becomes the old arr[source[i]], following each cycle
+ * of the permutation from a leader; every value is moved once (cycle leaders twice).
+ * source is consumed: entries are reset to i as positions are filled.
+ */
+template<typename T>
+void applyPermutation(T* arr, std::vector<size_t>& source) {
+    for (size_t start = 0; start < source.size(); ++start) {
+        if (source[start] == start) continue;
+        T leader = std::move(arr[start]);
+        size_t hole = start;
+        while (source[hole] != start) {
+            const size_t next = source[hole];
+            arr[hole] = std::move(arr[next]);
+            source[hole] = hole;
+            hole = next;
+        }
+        arr[hole] = std::move(leader);
+        source[hole] = hole;
+    }
+}
+
+} // namespace detail
+
+/**
+ * @class IndirectSort
+ * @brief Stable sort of large records through a compact array of indices
+ *
+ * The index array (or, with a key prefix, (prefix, index) entries) is sorted with
+ * QuadMergeSort, so the merge passes copy 8- or 16-byte entries instead of records.
+ * The result is then applied in place by cycle-leader moves. With a prefix, records are
+ * only compared when their prefixes tie. MergeSort switches to the prefix-less form by
+ * itself for types larger than MergeSort::kIndirectBytes; there every comparison touches
+ * two records at random, so the prefix form (indirectSort) is the faster one.
+ */
+template<typename T, typename Comparator>
+class IndirectSort {
+public:
+    static void sort(T* arr, size_t size, Comparator comp = Comparator()) {
+        if (size <= 1) return;
+        std::vector<size_t> order(size);
+        for (size_t i = 0; i < size; ++i) order[i] = i;
+        quadMergeSort(order, [arr, &comp](size_t a, size_t b) { return comp(arr[a], arr[b]); });
+        detail::applyPermutation(arr, order);
+    }
+
+    /**
+     * @brief Sorts with a numeric key prefix; prefix(a) < prefix(b) must imply comp(a, b)
+     */
+    template<typename Prefix>
+    static void sort(T* arr, size_t size, Prefix prefix, Comparator comp = Comparator()) {
+        if (size <= 1) return;
+        std::vector<detail::KeyIndex> entries(size);
+        for (size_t i = 0; i < size; ++i) entries[i] = {detail::orderedBits(prefix(arr[i])), i};
+        quadMergeSort(entries, [arr, &comp](const detail::KeyIndex& a, const detail::KeyIndex& b) {
+            if (a.key != b.key) return a.key < b.key;
+            return comp(arr[a.index], arr[b.index]);
+        });
+        std::vector<size_t> order(size);
+        for (size_t i = 0; i < size; ++i) order[i] = entries[i].index;
+        std::vector<detail::KeyIndex>().swap(entries);
+        detail::applyPermutation(arr, order);
+    }
+};
+
+template<typename T, typename Prefix, typename Comparator = std::less<T>>
+void indirectSort(std::vector<T>& arr, Prefix prefix, Comparator comp = Comparator()) {
+    IndirectSort<T, Comparator>::sort(arr.data(), arr.size(), prefix, comp);
+}
+
+/**
+ * @brief Integer kernels PairSort can run on the packed words
+ */
+enum class PairKernel {
+    Radix,  ///< LSD radix sort over the key bytes only
+    Merge   ///< QuadMergeSort comparing the key bits of each word
+};
+
+/**
+ * @class PairSort
+ * @brief Stable sort of (key, payload) pairs packed into single 64- or 128-bit words
+ *
+ * The key is mapped to order-preserving unsigned bits (sign bit flipped, floats
+ * normalized, all bits inverted for descending order) and placed above the payload's
+ * raw bits: in one uint64_t when both fit in 8 bytes, otherwise key in the high and
+ * payload in the low half of a Word128. The kernels then move and compare plain
+ * integers instead of structs and comparators, and the pairs are unpacked at the end.
+ * Pairs with equal keys keep their input order; -0.0 sorts before +0.0.
+ */
+template<typename K, typename V>
+class PairSort {
+    static_assert(std::is_arithmetic<K>::value, "PairSort keys must be arithmetic types");
+    static_assert(std::is_trivially_copyable<V>::value,
+                  "PairSort payloads must be trivially copyable");
+    static_assert(sizeof(K) + sizeof(V) <= 16, "PairSort packs key and payload into at most 128 bits");
+
+public:
+    static constexpr bool kNarrow = sizeof(K) + sizeof(V) <= 8;
+    using Word = typename std::conditional<kNarrow, uint64_t, detail::Word128>::type;
+
+    static void sort(std::vector<std::pair<K, V>>& pairs, SortOrder order = SortOrder::Ascending,
+                     PairKernel kernel = PairKernel::Radix) {
+        std::vector<Word> words(pairs.size());
+        for (size_t i = 0; i < pairs.size(); ++i) words[i] = pack(pairs[i].first, pairs[i].second, order);
+        sortWords(words, kernel);
+        for (size_t i = 0; i < pairs.size(); ++i) unpack(words[i], order, pairs[i].first, pairs[i].second);
+    }
+
+    /**
+     * @brief Sorts parallel key and payload columns, e.g. keys with their row ids
+     */
+    static void sort(std::vector<K>& keys, std::vector<V>& payloads, SortOrder order = SortOrder::Ascending,
+                     PairKernel kernel = PairKernel::Radix) {
+        if (keys.size() != payloads.size()) {
+            throw std::invalid_argument("PairSort::sort needs as many payloads as keys");
+        }
+        std::vector<Word> words(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) words[i] = pack(keys[i], payloads[i], order);
+        sortWords(words, kernel);
+        for (size_t i = 0; i < keys.size(); ++i) unpack(words[i], order, keys[i], payloads[i]);
+    }
+
+private:
+    static constexpr unsigned kPayloadBits = 8 * sizeof(V);
+    static constexpr uint64_t kKeyMask = sizeof(K) == 8 ? ~uint64_t(0) : (uint64_t(1) << (8 * sizeof(K))) - 1;
+    using PayloadBits = typename detail::UnsignedOfSize<sizeof(V)>::type;
+    // Key bits occupy bytes [kKeyByte, kKeyByte + sizeof(K)) of the word
+    static constexpr unsigned kKeyByte = kNarrow ? sizeof(V) : 8;
+
+    struct KeyLess {
+        bool operator()(uint64_t a, uint64_t b) const { return (a >> kPayloadBits) < (b >> kPayloadBits); }
+        bool operator()(const detail::Word128& a, const detail::Word128& b) const { return a.hi < b.hi; }
+    };
+
+    static Word pack(K key, const V& payload, SortOrder order) {
+        uint64_t keyBits = detail::orderedKeyBits(key);
+        if (order == SortOrder::Descending) keyBits = ~keyBits & kKeyMask;
+        PayloadBits raw;
+        std::memcpy(&raw, &payload, sizeof(V));
+        const uint64_t payloadBits = raw;
+        if constexpr (kNarrow) {
+            return (keyBits << kPayloadBits) | payloadBits;
+        } else {
+            return detail::Word128{keyBits, payloadBits};
+        }
+    }
+
+    static void unpack(const Word& word, SortOrder order, K& key, V& payload) {
+        uint64_t keyBits, payloadBits;
+        if constexpr (kNarrow) {
+            keyBits = word >> kPayloadBits;
+            payloadBits = word;
+        } else {
+            keyBits = word.hi;
+            payloadBits = word.lo;
+        }
+        if (order == SortOrder::Descending) keyBits = ~keyBits & kKeyMask;
+        key = detail::keyFromOrderedBits<K>(keyBits);
+        const PayloadBits raw = static_cast<PayloadBits>(payloadBits);
+        std::memcpy(&payload, &raw, sizeof(V));
+    }
+
+    static void sortWords(std::vector<Word>& words, PairKernel kernel) {
+        if (kernel == PairKernel::Radix) {
+            std::vector<Word> scratch;
+            detail::radixSortWords(words, scratch, kKeyByte, kKeyByte + sizeof(K));
+        } else {
+            QuadMergeSort<Word, KeyLess>::sort(words);
+        }
+    }
+};
+
+template<typename K, typename V>
+void pairSort(std::vector<std::pair<K, V>>& pairs, SortOrder order = SortOrder::Ascending,
+              PairKernel kernel = PairKernel::Radix) {
+    PairSort<K, V>::sort(pairs, order, kernel);
+}
+
+/**
+ * @brief Intrusive hook for nodes that store their successor in a member pointer
+ */
+template<typename Node, Node* Node::*Next>
+struct MemberNextHook {
+    static Node* next(const Node* node) { return node->*Next; }
+    static void setNext(Node* node, Node* next) { node->*Next = next; }
+};
+
+/**
+ * @class ListMergeSort
+ * @brief Stable natural merge sort of a null-terminated singly linked list
+ *
+ * Nodes are never copied or moved: merging relinks successor pointers through the
+ * Hook. Natural runs (non-decreasing, or strictly decreasing and then reversed) are
+ * detached one at a time and combined in a 64-slot binary counter, so extra memory
+ * is O(1) regardless of list length.
+ */
+template<typename Node, typename Hook, typename Comparator = std::less<Node>>
+class ListMergeSort {
+public:
+    static Node* sort(Node* head, Comparator comp = Comparator()) {
+        Node* bins[64] = {};
+        while (head) {
+            Node* carry = takeRun(head, comp);
+            size_t i = 0;
+            for (; bins[i]; ++i) {
+                carry = merge(bins[i], carry, comp);
+                bins[i] = nullptr;
+            }
+            bins[i] = carry;
+        }
+
+        Node* result = nullptr;
+        for (Node* bin : bins) {
+            if (bin) result = merge(bin, result, comp);
+        }
+        return result;
+    }
+
+private:
+    static Node* takeRun(Node*& head, Comparator& comp) {
+        Node* first = head;
+        Node* last = first;
+        Node* next = Hook::next(last);
+        if (next && comp(*next, *last)) {
+            // Strictly decreasing run: reverse while detaching, which keeps it stable
+            Node* reversed = first;
+            Hook::setNext(first, nullptr);
+            while (next && comp(*next, *last)) {
+                Node* after = Hook::next(next);
+                Hook::setNext(next, reversed);
+                reversed = next;
+                last = next;
+                next = after;
+            }
+            head = next;
+            return reversed;
+        }
+
+        while (next && !comp(*next, *last)) {
+            last = next;
+            next = Hook::next(next);
+        }
+        Hook::setNext(last, nullptr);
+        head = next;
+        return first;
+    }
+
+    static Node* merge(Node* a, Node* b, Comparator& comp) {
+        if (!a) return b;
+        if (!b) return a;
+
+        Node* head;
+        if (comp(*b, *a)) {
+            head = b;
+            b = Hook::next(b);
+        } else {
+            head = a;
+            a = Hook::next(a);
+        }
+
+        Node* tail = head;
+        while (a && b) {
+            if (comp(*b, *a)) {
+                Hook::setNext(tail, b);
+                tail = b;
+                b = Hook::next(b);
+            } else {
+                Hook::setNext(tail, a);
+                tail = a;
+                a = Hook::next(a);
+            }
+        }
+        Hook::setNext(tail, a ? a : b);
+        return head;
+    }
+};
+
+namespace detail {
+
+template<typename T, typename A>
+void spliceFront(std::forward_list<T, A>& dst, std::forward_list<T, A>& src,
+                 typename std::forward_list<T, A>::iterator last) {
+    dst.splice_after(dst.before_begin(), src, src.before_begin(), last);
+}
+
+template<typename T, typename A>
+void spliceFront(std::list<T, A>& dst, std::list<T, A>& src, typename std::list<T, A>::iterator last) {
+    dst.splice(dst.begin(), src, src.begin(), last);
+}
+
+/**
+ * @brief Natural merge sort of a std::list or std::forward_list by splicing nodes
+ */
+template<typename List, typename Comparator>
+void spliceMergeSort(List& list, Comparator& comp) {
+    List bins[64];
+    List run;
+    try {
+        while (!list.empty()) {
+            auto prev = list.begin();
+            auto it = std::next(prev);
+            bool descending = false;
+            if (it != list.end() && comp(*it, *prev)) {
+                descending = true;
+                do {
+                    prev = it;
+                    ++it;
+                } while (it != list.end() && comp(*it, *prev));
+            } else {
+                while (it != list.end() && !comp(*it, *prev)) {
+                    prev = it;
+                    ++it;
+                }
+            }
+            spliceFront(run, list, it);
+            if (descending) run.reverse();
+
+            size_t i = 0;
+            for (; !bins[i].empty(); ++i) {
+                bins[i].merge(run, comp);
+                bins[i].swap(run);
+            }
+            bins[i].swap(run);
+        }
+
+        for (List& bin : bins) {
+            bin.merge(run, comp);
+            bin.swap(run);
+        }
+        list.swap(run);
+    } catch (...) {
+        // Return every node to the caller's list before propagating
+        spliceFront(list, run, run.end());
+        for (List& bin : bins) spliceFront(list, bin, bin.end());
+        throw;
+    }
+}
+
+} // namespace detail
+
+template<typename T, typename A, typename Comparator = std::less<T>>
+void listMergeSort(std::forward_list<T, A>& list, Comparator comp = Comparator()) {
+    detail::spliceMergeSort(list, comp);
+}
+
+template<typename T, typename A, typename Comparator = std::less<T>>
+void listMergeSort(std::list<T, A>& list, Comparator comp = Comparator()) {
+    detail::spliceMergeSort(list, comp);
+}
+
+/**
+ * @brief Sorts an intrusive list given its head node; returns the new head
+ */
+template<typename Hook, typename Node, typename Comparator = std::less<Node>>
+Node* listMergeSort(Node* head, Comparator comp = Comparator()) {
+    return ListMergeSort<Node, Hook, Comparator>::sort(head, comp);
+}
+
+/**
+ * @brief Run source over an in-memory sorted vector, for use with RunMerger
+ */
+template<typename T>
+class VectorRunSource {
+public:
+    explicit VectorRunSource(std::vector<T>& run) : pos_(run.data()), end_(run.data() + run.size()) {}
+
+    bool next(T& value) {
+        if (pos_ == end_) return false;
+        value = std::move(*pos_++);
+        return true;
+    }
+
+private:
+    T* pos_;
+    T* end_;
+};
+
+/**
+ * @class RunMerger
+ * @brief Stable k-way merge of sorted runs read from arbitrary sources
+ *
+ * A Source is anything with `bool next(T&)`. Heads are kept in a binary heap; on equal
+ * keys the run with the lower index wins, so merging runs in input order is stable.
+ */
+template<typename T, typename Source, typename Comparator = std::less<T>>
+class RunMerger {
+public:
+    explicit RunMerger(std::vector<Source> sources, Comparator comp = Comparator())
+        : sources_(std::move(sources)), heads_(sources_.size()), comp_(comp) {
+        for (size_t r = 0; r < sources_.size(); ++r) {
+            if (sources_[r].next(heads_[r])) heap_.push_back(r);
+        }
+        std::make_heap(heap_.begin(), heap_.end(), HeapOrder{this});
+    }
+
+    bool next(T& value) {
+        if (heap_.empty()) return false;
+        std::pop_heap(heap_.begin(), heap_.end(), HeapOrder{this});
+        const size_t r = heap_.back();
+        value = std::move(heads_[r]);
+        if (sources_[r].next(heads_[r])) {
+            std::push_heap(heap_.begin(), heap_.end(), HeapOrder{this});
+        } else {
+            heap_.pop_back();
+        }
+        return true;
+    }
+
+private:
+    struct HeapOrder {
+        RunMerger* self;
+        bool operator()(size_t a, size_t b) const {
+            if (self->comp_(self->heads_[b], self->heads_[a])) return true;
+            if (self->comp_(self->heads_[a], self->heads_[b])) return false;
+            return b < a;
+        }
+    };
+
+    std::vector<Source> sources_;
+    std::vector<T> heads_;
+    std::vector<size_t> heap_;
+    Comparator comp_;
+};
+
+/**
+ * @brief Merges sorted in-memory runs into one vector, consuming the runs
+ */
+template<typename T, typename Comparator = std::less<T>>
+std::vector<T> mergeRuns(std::vector<std::vector<T>>& runs, Comparator comp = Comparator()) {
+    size_t total = 0;
+    std::vector<VectorRunSource<T>> sources;
+    sources.reserve(runs.size());
+    for (auto& run : runs) {
+        total += run.size();
+        sources.emplace_back(run);
+    }
+
+    std::vector<T> out;
+    out.reserve(total);
+    if (runs.size() == 1) {
+        out.swap(runs[0]);
+    } else {
+        RunMerger<T, VectorRunSource<T>, Comparator> merger(std::move(sources), comp);
+        T value;
+        while (merger.next(value)) out.push_back(std::move(value));
+    }
+    runs.clear();
+    return out;
+}
+
+/**
+ * @class ChunkedSorter
+ * @brief Sorts input in fixed-size chunks on an executor while it is still arriving
+ *
+ * push() fills the current chunk and hands it to the executor once full, so the producer
+ * (typically a parser) keeps running while earlier chunks are sorted. finish() waits for
+ * the chunk sorts, helping with any not started yet, and k-way merges the sorted chunks.
+ * Without an executor (and no default executor), a private ThreadPool of `workers`
+ * threads sorts the chunks.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class ChunkedSorter {
+public:
+    explicit ChunkedSorter(size_t chunkSize = size_t(1) << 16, size_t workers = 0,
+                           Comparator comp = Comparator(), Executor* executor = nullptr)
+        : chunkSize_(chunkSize), comp_(comp) {
+        if (chunkSize_ == 0) throw std::invalid_argument("ChunkedSorter chunk size must be positive");
+        if (!executor) executor = defaultExecutor();
+        if (!executor) {
+            pool_.reset(new ThreadPool(workers));
+            executor = pool_.get();
+        }
+        tasks_.reset(new detail::TaskGroup(*executor));
+        current_.reserve(chunkSize_);
+    }
+
+    ChunkedSorter(const ChunkedSorter&) = delete;
+    ChunkedSorter& operator=(const ChunkedSorter&) = delete;
+
+    void push(T value) {
+        current_.push_back(std::move(value));
+        if (current_.size() == chunkSize_) submit();
+    }
+
+    size_t chunkCount() const { return sorted_.size(); }
+
+    std::vector<T> finish() {
+        if (!current_.empty()) submit();
+        tasks_->wait();
+        std::vector<std::vector<T>> runs;
+        runs.reserve(sorted_.size());
+        for (auto& run : sorted_) runs.push_back(std::move(run));
+        sorted_.clear();
+        return mergeRuns(runs, comp_);
+    }
+
+private:
+    void submit() {
+        // deque::push_back keeps references to earlier chunks valid while they are sorted
+        sorted_.emplace_back();
+        std::vector<T>* chunk = &sorted_.back();
+        chunk->swap(current_);
+        current_.reserve(chunkSize_);
+        tasks_->run([this, chunk]() { QuadMergeSort<T, Comparator>::sort(*chunk, comp_); });
+    }
+
+    const size_t chunkSize_;
+    Comparator comp_;
+    std::vector<T> current_;
+    std::deque<std::vector<T>> sorted_;
+    std::unique_ptr<ThreadPool> pool_;
+    std::unique_ptr<detail::TaskGroup> tasks_;  ///< declared after pool_: waited for before the pool stops
+};
+
+namespace detail {
+
+inline bool isSeparator(char c) {
+    return c == ',' || c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+/**
+ * @brief Parses one integer token (optional sign, decimal digits) spanning [begin, end)
+ */
+template<typename T>
+void parseInteger(const char* begin, const char* end, T& value) {
+    // A '+' counts as the sign only before a digit, so "+-5" stays invalid
+    const bool plus = begin != end && *begin == '+' && begin + 1 != end &&
+                      std::isdigit(static_cast<unsigned char>(begin[1]));
+    const char* digits = plus ? begin + 1 : begin;
+    const auto result = std::from_chars(digits, end, value);
+    if (result.ec == std::errc::result_out_of_range) {
+        throw std::out_of_range("Integer out of range: '" + std::string(begin, end) + "'");
+    }
+    if (result.ec != std::errc() || result.ptr != end) {
+        throw std::invalid_argument("Invalid integer: '" + std::string(begin, end) + "'");
+    }
+}
+
+inline void storeLE(uint64_t value, unsigned char* out, size_t width) {
+    for (size_t i = 0; i < width; ++i) out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline uint64_t loadLE(const unsigned char* in, size_t width) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; ++i) value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    return value;
+}
+
+inline uint64_t zigzag(uint64_t delta) {
+    return (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+}
+
+inline uint64_t unzigzag(uint64_t encoded) {
+    return (encoded >> 1) ^ (~(encoded & 1) + 1);
+}
+
+} // namespace detail
+
+namespace io {
+
+/**
+ * @class TextReader
+ * @brief Buffered streaming parser for integers separated by whitespace or commas
+ */
+template<typename T>
+class TextReader {
+public:
+    explicit TextReader(std::FILE* file, size_t bufferSize = size_t(1) << 20)
+        : file_(file), buffer_(bufferSize) {
+        if (!file_) throw std::invalid_argument("Null FILE* passed to TextReader");
+    }
+
+    bool next(T& value) {
+        for (;;) {
+            while (pos_ < end_ && detail::isSeparator(buffer_[pos_])) ++pos_;
+            if (pos_ < end_) break;
+            if (!refill()) return false;
+        }
+
+        const size_t start = pos_;
+        while (pos_ < end_ && !detail::isSeparator(buffer_[pos_])) ++pos_;
+        if (pos_ < end_) {
+            detail::parseInteger(buffer_.data() + start, buffer_.data() + pos_, value);
+            return true;
+        }
+
+        // The token continues in the next buffer
+        token_.assign(buffer_.data() + start, pos_ - start);
+        while (refill()) {
+            const size_t from = pos_;
+            while (pos_ < end_ && !detail::isSeparator(buffer_[pos_])) ++pos_;
+            token_.append(buffer_.data() + from, pos_ - from);
+            if (pos_ < end_) break;
+        }
+        detail::parseInteger(token_.data(), token_.data() + token_.size(), value);
+        return true;
+    }
+
+private:
+    bool refill() {
+        pos_ = 0;
+        end_ = std::fread(buffer_.data(), 1, buffer_.size(), file_);
+        if (end_ == 0 && std::ferror(file_)) throw std::runtime_error("Read error while parsing input");
+        return end_ > 0;
+    }
+
+    std::FILE* file_;
+    std::vector<char> buffer_;
+    std::string token_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+};
+
+/**
+ * @class TextWriter
+ * @brief Buffered integer formatter writing one value per separator-terminated field
+ */
+template<typename T>
+class TextWriter {
+public:
+    explicit TextWriter(std::FILE* file, char separator = '\n', size_t bufferSize = size_t(1) << 20)
+        : file_(file), separator_(separator) {
+        if (!file_) throw std::invalid_argument("Null FILE* passed to TextWriter");
+        buffer_.reserve(bufferSize);
+    }
+
+    ~TextWriter() {
+        try {
+            flush();
+        } catch (...) {
+        }
+    }
+
+    void write(T value) {
+        if (buffer_.capacity() - buffer_.size() < 32) flush();
+        char digits[32];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        buffer_.insert(buffer_.end(), digits, result.ptr);
+        buffer_.push_back(separator_);
+    }
+
+    void flush() {
+        if (buffer_.empty()) return;
+        if (std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+            throw std::runtime_error("Write error while emitting output");
+        }
+        buffer_.clear();
+    }
+
+private:
+    std::FILE* file_;
+    char separator_;
+    std::vector<char> buffer_;
+};
+
+/**
+ * @class MappedFile
+ * @brief Read-only view of a whole file, memory-mapped where the platform allows it
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef SORTING_POSIX
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open '" + path + "': " + std::strerror(errno));
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            const int err = errno;
+            ::close(fd);
+            throw std::runtime_error("Cannot stat '" + path + "': " + std::strerror(err));
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        if (size_ > 0) {
+            void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                const int err = errno;
+                ::close(fd);
+                throw std::runtime_error("Cannot map '" + path + "': " + std::strerror(err));
+            }
+            ::madvise(mapped, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(mapped);
+        }
+        ::close(fd);
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error("Cannot open '" + path + "'");
+        fallback_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data_ = fallback_.data();
+        size_ = fallback_.size();
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef SORTING_POSIX
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifndef SORTING_POSIX
+    std::vector<char> fallback_;
+#endif
+};
+
+/**
+ * @brief Splits text into roughly equal pieces whose boundaries fall on separators
+ *
+ * Returns pieces + 1 offsets; piece i is [bounds[i], bounds[i + 1]), and no integer
+ * token straddles two pieces.
+ */
+inline std::vector<size_t> splitAtSeparators(const char* data, size_t size, size_t pieces) {
+    pieces = std::max<size_t>(1, pieces);
+    std::vector<size_t> bounds(pieces + 1, size);
+    bounds[0] = 0;
+    for (size_t i = 1; i < pieces; ++i) {
+        size_t b = std::max(bounds[i - 1], size / pieces * i);
+        while (b < size && !detail::isSeparator(data[b])) ++b;
+        bounds[i] = b;
+    }
+    return bounds;
+}
+
+/**
+ * @brief Parses every integer in [begin, end) and appends it to out
+ */
+template<typename T>
+void parseRange(const char* begin, const char* end, std::vector<T>& out) {
+    const char* p = begin;
+    for (;;) {
+        while (p < end && detail::isSeparator(*p)) ++p;
+        if (p == end) return;
+        const char* token = p;
+        while (p < end && !detail::isSeparator(*p)) ++p;
+        T value;
+        detail::parseInteger(token, p, value);
+        out.push_back(value);
+    }
+}
+
+/**
+ * @brief Parses a text buffer on several threads into one vector
+ *
+ * Each thread parses one separator-aligned piece into its own vector; the pieces are
+ * then copied in parallel to prefix-summed offsets of the result.
+ */
+template<typename T>
+std::vector<T> parseParallel(const char* data, size_t size, size_t pieces = 0) {
+    if (pieces == 0) pieces = std::max<size_t>(1, std::thread::hardware_concurrency());
+    const std::vector<size_t> bounds = splitAtSeparators(data, size, pieces);
+    std::vector<std::vector<T>> parts(pieces);
+    detail::parallelFor(pieces, [&](size_t i) {
+        parts[i].reserve((bounds[i + 1] - bounds[i]) / 8);
+        parseRange(data + bounds[i], data + bounds[i + 1], parts[i]);
+    });
+
+    std::vector<size_t> offsets(pieces + 1, 0);
+    for (size_t i = 0; i < pieces; ++i) offsets[i + 1] = offsets[i] + parts[i].size();
+    std::vector<T> out(offsets[pieces]);
+    detail::parallelFor(pieces, [&](size_t i) {
+        std::copy(parts[i].begin(), parts[i].end(), out.begin() + offsets[i]);
+    });
+    return out;
+}
+
+/**
+ * @brief Payload encodings of the binary value format
+ */
+enum class Encoding : uint8_t {
+    Raw = 0,          ///< fixed-width little-endian integers
+    DeltaVarint = 1,  ///< LEB128 varints of deltas between consecutive values
+    BlockPacked = 2   ///< deltas bit-packed at a per-block width, 128 values per block
+};
+
+/**
+ * @brief 16-byte header of the binary value format
+ *
+ * Layout: "MSRT" magic, version, encoding, value type (width in bytes, 0x80 if signed),
+ * flags (bit 0: sorted ascending), then the value count as a little-endian uint64.
+ * A BlockPacked payload is a sequence of blocks, each holding a byte with the value count
+ * minus one, a byte with the bit width, and count * width bits of packed deltas.
+ */
+struct BinaryHeader {
+    static constexpr char kMagic[4] = {'M', 'S', 'R', 'T'};
+    static constexpr uint8_t kVersion = 1;
+    static constexpr uint8_t kSortedFlag = 0x01;
+    static constexpr uint64_t kUnknownCount = ~uint64_t(0);
+    static constexpr size_t kSize = 16;
+    static constexpr size_t kBlockValues = 128;
+
+    Encoding encoding = Encoding::Raw;
+    uint8_t valueType = 0;
+    bool sorted = false;
+    uint64_t count = kUnknownCount;
+
+    template<typename T>
+    static uint8_t typeCode() {
+        static_assert(std::is_integral<T>::value && sizeof(T) <= 8, "Binary format stores integers up to 64 bits");
+        return static_cast<uint8_t>(sizeof(T) | (std::is_signed<T>::value ? 0x80 : 0));
+    }
+};
+
+/**
+ * @class BinaryWriter
+ * @brief Streaming writer for the binary value format
+ *
+ * With DeltaVarint, sorted output stores unsigned deltas (typically one or two bytes per
+ * value); unsorted output stores zigzag-encoded signed deltas instead. BlockPacked stores
+ * the same deltas bit-packed at the narrowest width that fits each 128-value block.
+ * Declaring the output sorted and then writing a smaller value throws std::invalid_argument.
+ */
+template<typename T>
+class BinaryWriter {
+public:
+    BinaryWriter(std::FILE* file, Encoding encoding, bool sorted,
+                 uint64_t count = BinaryHeader::kUnknownCount, size_t bufferSize = size_t(1) << 20)
+        : file_(file), encoding_(encoding), sorted_(sorted), declared_(count) {
+        if (!file_) throw std::invalid_argument("Null FILE* passed to BinaryWriter");
+        buffer_.reserve(std::max<size_t>(bufferSize, 64));
+        if (std::ftell(file_) >= 0) headerPos_ = std::ftell(file_);
+        writeHeader(declared_);
+    }
+
+    BinaryWriter(const BinaryWriter&) = delete;
+    BinaryWriter& operator=(const BinaryWriter&) = delete;
+
+    ~BinaryWriter() {
+        try {
+            emitBlock();
+            flush();
+        } catch (...) {
+        }
+    }
+
+    void write(T value) {
+        if (buffer_.capacity() - buffer_.size() < 16) flush();
+        const uint64_t bits = detail::orderedBits(value);
+        if (sorted_ && written_ > 0 && bits < previous_) {
+            throw std::invalid_argument("BinaryWriter: value out of order for sorted output");
+        }
+        if (encoding_ == Encoding::Raw) {
+            unsigned char bytes[8];
+            detail::storeLE(static_cast<uint64_t>(value), bytes, sizeof(T));
+            buffer_.insert(buffer_.end(), bytes, bytes + sizeof(T));
+        } else {
+            const uint64_t delta = bits - previous_;
+            const uint64_t encoded = sorted_ ? delta : detail::zigzag(delta);
+            if (encoding_ == Encoding::DeltaVarint) {
+                putVarint(encoded);
+            } else {
+                block_[blockSize_++] = encoded;
+                if (blockSize_ == BinaryHeader::kBlockValues) emitBlock();
+            }
+        }
+        previous_ = bits;
+        ++written_;
+    }
+
+    /**
+     * @brief Flushes buffered data and, when the count was not declared, patches it if seekable
+     */
+    void finish() {
+        emitBlock();
+        flush();
+        if (declared_ == BinaryHeader::kUnknownCount) {
+            if (headerPos_ >= 0 && std::fseek(file_, headerPos_, SEEK_SET) == 0) {
+                writeHeader(written_);
+                flush();
+                bytesWritten_ -= BinaryHeader::kSize;  // the patch overwrote a header already counted
+                std::fseek(file_, 0, SEEK_END);
+            }
+        } else if (declared_ != written_) {
+            throw std::logic_error("BinaryWriter: wrote " + std::to_string(written_) +
+                                   " values but header declared " + std::to_string(declared_));
+        }
+        if (std::fflush(file_) != 0) throw std::runtime_error("Write error while flushing binary output");
+    }
+
+    void flush() {
+        if (buffer_.empty()) return;
+        if (std::fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+            throw std::runtime_error("Write error while emitting binary output");
+        }
+        bytesWritten_ += buffer_.size();
+        buffer_.clear();
+    }
+
+    uint64_t count() const { return written_; }
+    uint64_t bytesWritten() const { return bytesWritten_ + buffer_.size(); }
+
+private:
+    void writeHeader(uint64_t count) {
+        unsigned char header[BinaryHeader::kSize];
+        std::memcpy(header, BinaryHeader::kMagic, 4);
+        header[4] = BinaryHeader::kVersion;
+        header[5] = static_cast<uint8_t>(encoding_);
+        header[6] = BinaryHeader::typeCode<T>();
+        header[7] = sorted_ ? BinaryHeader::kSortedFlag : 0;
+        detail::storeLE(count, header + 8, 8);
+        buffer_.insert(buffer_.end(), header, header + sizeof(header));
+    }
+
+    void putVarint(uint64_t v) {
+        while (v >= 0x80) {
+            buffer_.push_back(static_cast<unsigned char>(v | 0x80));
+            v >>= 7;
+        }
+        buffer_.push_back(static_cast<unsigned char>(v));
+    }
+
+    void emitBlock() {
+        if (blockSize_ == 0) return;
+        uint64_t any = 0;
+        for (size_t i = 0; i < blockSize_; ++i) any |= block_[i];
+        unsigned width = 0;
+        while (width < 64 && (any >> width) != 0) ++width;
+
+        const size_t packedBytes = (blockSize_ * width + 7) / 8;
+        if (buffer_.capacity() - buffer_.size() < packedBytes + 2) flush();
+        buffer_.push_back(static_cast<unsigned char>(blockSize_ - 1));
+        buffer_.push_back(static_cast<unsigned char>(width));
+
+        unsigned char word[8];
+        uint64_t acc = 0;
+        unsigned filled = 0;
+        for (size_t i = 0; i < blockSize_ && width > 0; ++i) {
+            const uint64_t v = block_[i];
+            acc |= v << filled;
+            if (filled + width >= 64) {
+                detail::storeLE(acc, word, 8);
+                buffer_.insert(buffer_.end(), word, word + 8);
+                acc = filled ? v >> (64 - filled) : 0;
+                filled = filled + width - 64;
+            } else {
+                filled += width;
+            }
+        }
+        detail::storeLE(acc, word, 8);
+        buffer_.insert(buffer_.end(), word, word + (filled + 7) / 8);
+        blockSize_ = 0;
+    }
+
+    std::FILE* file_;
+    Encoding encoding_;
+    bool sorted_;
+    uint64_t declared_;
+    uint64_t block_[BinaryHeader::kBlockValues];
+    size_t blockSize_ = 0;
+    long headerPos_ = -1;
+    uint64_t written_ = 0;
+    uint64_t previous_ = 0;
+    uint64_t bytesWritten_ = 0;
+    std::vector<unsigned char> buffer_;
+};
+
+/**
+ * @class BinaryReader
+ * @brief Streaming reader for the binary value format; the encoding comes from the header
+ */
+template<typename T>
+class BinaryReader {
+public:
+    explicit BinaryReader(std::FILE* file, size_t bufferSize = size_t(1) << 20)
+        : file_(file), buffer_(std::max<size_t>(bufferSize, 64)) {
+        if (!file_) throw std::invalid_argument("Null FILE* passed to BinaryReader");
+        unsigned char header[BinaryHeader::kSize];
+        for (unsigned char& byte : header) {
+            if (!getByte(byte)) throw std::runtime_error("Binary input is shorter than its header");
+        }
+        if (std::memcmp(header, BinaryHeader::kMagic, 4) != 0) {
+            throw std::runtime_error("Binary input has a bad magic number");
+        }
+        if (header[4] != BinaryHeader::kVersion) throw std::runtime_error("Unsupported binary format version");
+        if (header[5] > static_cast<uint8_t>(Encoding::BlockPacked)) {
+            throw std::runtime_error("Unknown binary encoding");
+        }
+        if (header[6] != BinaryHeader::typeCode<T>()) {
+            throw std::runtime_error("Binary input value type does not match the requested type");
+        }
+        header_.encoding = static_cast<Encoding>(header[5]);
+        header_.valueType = header[6];
+        header_.sorted = (header[7] & BinaryHeader::kSortedFlag) != 0;
+        header_.count = detail::loadLE(header + 8, 8);
+    }
+
+    const BinaryHeader& header() const { return header_; }
+
+    bool next(T& value) {
+        if (read_ == header_.count) return false;
+        if (header_.encoding == Encoding::BlockPacked) {
+            if (blockPos_ == blockSize_ && !decodeBlock()) return false;
+            value = detail::fromOrderedBits<T>(decoded_[blockPos_++]);
+            ++read_;
+            return true;
+        }
+        if (header_.encoding == Encoding::Raw) {
+            unsigned char bytes[8];
+            for (size_t i = 0; i < sizeof(T); ++i) {
+                if (!getByte(bytes[i])) return truncated(i == 0);
+            }
+            value = static_cast<T>(detail::loadLE(bytes, sizeof(T)));
+            ++read_;
+            return true;
+        }
+
+        uint64_t encoded = 0;
+        unsigned char byte;
+        for (unsigned shift = 0;; shift += 7) {
+            if (!getByte(byte)) return truncated(shift == 0);
+            if (shift > 63) throw std::runtime_error("Corrupt varint in binary input");
+            encoded |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        previous_ += header_.sorted ? encoded : detail::unzigzag(encoded);
+        value = detail::fromOrderedBits<T>(previous_);
+        ++read_;
+        return true;
+    }
+
+private:
+    /**
+     * @brief Unpacks one block; every value is extracted with the same load-shift-mask
+     * sequence, so the loop has no data-dependent branches
+     */
+    bool decodeBlock() {
+        unsigned char sizeByte, width;
+        if (!getByte(sizeByte)) return truncated(true);
+        if (!getByte(width) || width > 64) throw std::runtime_error("Corrupt block in binary input");
+        const size_t count = size_t(sizeByte) + 1;
+        const size_t packedBytes = (count * width + 7) / 8;
+        unsigned char packed[BinaryHeader::kBlockValues * 8 + 16] = {};
+        for (size_t i = 0; i < packedBytes; ++i) {
+            if (!getByte(packed[i])) return truncated(false);
+        }
+
+        const uint64_t mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+        for (size_t i = 0; i < count; ++i) {
+            const size_t bit = i * width;
+            const unsigned shift = bit & 7;
+            uint64_t v = detail::loadLE(packed + bit / 8, 8) >> shift;
+            if (shift + width > 64) v |= uint64_t(packed[bit / 8 + 8]) << (64 - shift);
+            decoded_[i] = v & mask;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            previous_ += header_.sorted ? decoded_[i] : detail::unzigzag(decoded_[i]);
+            decoded_[i] = previous_;
+        }
+        blockSize_ = count;
+        blockPos_ = 0;
+        return true;
+    }
+
+    bool getByte(unsigned char& byte) {
+        if (pos_ == end_) {
+            pos_ = 0;
+            end_ = std::fread(buffer_.data(), 1, buffer_.size(), file_);
+            if (end_ == 0) {
+                if (std::ferror(file_)) throw std::runtime_error("Read error while parsing binary input");
+                return false;
+            }
+        }
+        byte = buffer_[pos_++];
+        return true;
+    }
+
+    bool truncated(bool atValueBoundary) {
+        if (atValueBoundary && header_.count == BinaryHeader::kUnknownCount) return false;
+        throw std::runtime_error("Binary input ends before its declared value count");
+    }
+
+    std::FILE* file_;
+    std::vector<unsigned char> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    BinaryHeader header_;
+    uint64_t read_ = 0;
+    uint64_t previous_ = 0;
+    uint64_t decoded_[BinaryHeader::kBlockValues];
+    size_t blockSize_ = 0;
+    size_t blockPos_ = 0;
+};
+
+struct FileCloser {
+    void operator()(std::FILE* file) const {
+        if (file) std::fclose(file);
+    }
+};
+
+using FileHandle = std::unique_ptr<std::FILE, FileCloser>;
+
+inline FileHandle openFile(const std::string& path, const char* mode) {
+    FileHandle file(std::fopen(path.c_str(), mode));
+    if (!file) throw std::runtime_error("Cannot open '" + path + "': " + std::strerror(errno));
+    return file;
+}
+
+} // namespace io
+
+namespace detail {
+
+/**
+ * @brief Flushes stdio buffers and forces the file's data to stable storage
+ */
+inline void syncFile(std::FILE* file) {
+    if (std::fflush(file) != 0) throw std::runtime_error("Cannot flush file before sync");
+#ifdef SORTING_POSIX
+    if (::fsync(::fileno(file)) != 0) throw std::runtime_error(std::string("fsync failed: ") + std::strerror(errno));
+#endif
+}
+
+/**
+ * @brief Makes renames and new directory entries durable
+ */
+inline void syncDirectory(const std::string& path) {
+#ifdef SORTING_POSIX
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open directory '" + path + "': " + std::strerror(errno));
+    const int result = ::fsync(fd);
+    ::close(fd);
+    if (result != 0) throw std::runtime_error("fsync of directory '" + path + "' failed");
+#else
+    (void)path;
+#endif
+}
+
+} // namespace detail
+
+namespace io {
+
+/**
+ * @brief How ExternalSort reads and writes its run files
+ */
+enum class IoBackend {
+    Stdio,  ///< buffered stdio through the page cache
+    Direct  ///< O_DIRECT with aligned buffers, through io_uring when the kernel allows it
+};
+
+/**
+ * @class AsyncIo
+ * @brief Positional reads and writes completed through io_uring, or synchronously otherwise
+ *
+ * Each request names a Completion that is marked done once the kernel reports it. The
+ * ring is set up with raw system calls, so liburing is not needed; where io_uring is
+ * missing or blocked (old kernels, seccomp filters, non-Linux systems) submit() falls
+ * back to pread/pwrite and completes the request before returning. Not thread-safe.
+ */
+class AsyncIo {
+public:
+    struct Completion {
+        bool done = true;
+        long result = 0;  ///< bytes transferred, or -errno
+    };
+
+    explicit AsyncIo(unsigned depth = 256) {
+#ifdef SORTING_IO_URING
+        setupRing(depth);
+#else
+        (void)depth;
+#endif
+    }
+
+    AsyncIo(const AsyncIo&) = delete;
+    AsyncIo& operator=(const AsyncIo&) = delete;
+
+    ~AsyncIo() {
+#ifdef SORTING_IO_URING
+        if (ringFd_ < 0) return;
+        try {
+            while (inFlight_ > 0) reap(true);
+        } catch (...) {
+        }
+        ::munmap(sqes_, sqesBytes_);
+        if (cqRing_ != sqRing_) ::munmap(cqRing_, cqBytes_);
+        ::munmap(sqRing_, sqBytes_);
+        ::close(ringFd_);
+#endif
+    }
+
+    bool usesRing() const { return ringFd_ >= 0; }
+
+    /**
+     * @brief Starts a transfer of size bytes at offset; data and completion must outlive it
+     */
+    void submit(bool write, int fd, void* data, size_t size, uint64_t offset, Completion& completion) {
+        completion.done = false;
+#ifdef SORTING_IO_URING
+        if (ringFd_ >= 0) {
+            while (inFlight_ >= sqEntries_) reap(true);
+            const unsigned tail = *sqTail_;
+            const unsigned index = tail & *sqMask_;
+            io_uring_sqe& sqe = sqes_[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<uint64_t>(data);
+            sqe.len = static_cast<uint32_t>(size);
+            sqe.off = offset;
+            sqe.user_data = reinterpret_cast<uint64_t>(&completion);
+            sqArray_[index] = index;
+            __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+            ++inFlight_;
+            enter(1, 0, 0);
+            return;
+        }
+#endif
+#ifdef SORTING_POSIX
+        const ssize_t result = write ? ::pwrite(fd, data, size, static_cast<off_t>(offset))
+                                     : ::pread(fd, data, size, static_cast<off_t>(offset));
+        completion.result = result < 0 ? -errno : result;
+#else
+        (void)write; (void)fd; (void)data; (void)size; (void)offset;
+        completion.result = -ENOSYS;
+#endif
+        completion.done = true;
+    }
+
+    void wait(Completion& completion) {
+        while (!completion.done) reap(true);
+    }
+
+private:
+#ifdef SORTING_IO_URING
+    void setupRing(unsigned depth) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        const int fd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &params));
+        if (fd < 0) return;
+        // IORING_OP_READ/WRITE date from 5.6; FAST_POLL (5.7) is the nearest feature bit proving them
+        if (!(params.features & IORING_FEAT_FAST_POLL)) {
+            ::close(fd);
+            return;
+        }
+        sqBytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqBytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sqBytes_ = cqBytes_ = std::max(sqBytes_, cqBytes_);
+        sqesBytes_ = params.sq_entries * sizeof(io_uring_sqe);
+
+        void* sq = ::mmap(nullptr, sqBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        void* cq = single ? sq : ::mmap(nullptr, cqBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                         IORING_OFF_CQ_RING);
+        void* sqes = ::mmap(nullptr, sqesBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+            if (sqes != MAP_FAILED) ::munmap(sqes, sqesBytes_);
+            if (cq != MAP_FAILED && cq != sq) ::munmap(cq, cqBytes_);
+            if (sq != MAP_FAILED) ::munmap(sq, sqBytes_);
+            ::close(fd);
+            return;
+        }
+        char* sqBase = static_cast<char*>(sq);
+        char* cqBase = static_cast<char*>(cq);
+        sqRing_ = sq;
+        cqRing_ = cq;
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+        sqTail_ = reinterpret_cast<unsigned*>(sqBase + params.sq_off.tail);
+        sqMask_ = reinterpret_cast<unsigned*>(sqBase + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned*>(sqBase + params.sq_off.array);
+        cqHead_ = reinterpret_cast<unsigned*>(cqBase + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cqBase + params.cq_off.tail);
+        cqMask_ = reinterpret_cast<unsigned*>(cqBase + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cqBase + params.cq_off.cqes);
+        sqEntries_ = params.sq_entries;
+        ringFd_ = fd;
+    }
+
+    void enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        while (::syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags, nullptr, 0) < 0) {
+            if (errno != EINTR) throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+        }
+    }
+#endif
+
+    void reap(bool block) {
+#ifdef SORTING_IO_URING
+        unsigned head = *cqHead_;
+        if (block && head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) enter(0, 1, IORING_ENTER_GETEVENTS);
+        const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes_[head & *cqMask_];
+            Completion* completion = reinterpret_cast<Completion*>(cqe.user_data);
+            completion->result = cqe.res;
+            completion->done = true;
+            --inFlight_;
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+#else
+        (void)block;
+#endif
+    }
+
+    int ringFd_ = -1;
+#ifdef SORTING_IO_URING
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    size_t sqBytes_ = 0;
+    size_t cqBytes_ = 0;
+    size_t sqesBytes_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned* sqMask_ = nullptr;
+    unsigned* sqArray_ = nullptr;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned* cqMask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned sqEntries_ = 0;
+    unsigned inFlight_ = 0;
+#endif
+};
+
+#if defined(SORTING_POSIX) && defined(__GLIBC__)
+#define SORTING_DIRECT_IO 1
+
+/**
+ * @class DirectFile
+ * @brief Sequential O_DIRECT file exposed as an unbuffered FILE* via fopencookie
+ *
+ * Writes are gathered into `depth` aligned buffers; a full buffer is submitted and the
+ * next one filled while it is in flight. Reads keep `depth` aligned buffers in flight
+ * ahead of the stream position. Rewrites of already written bytes (the header count that
+ * BinaryWriter patches in finish()) are applied in close() by read-modify-write of the
+ * aligned blocks they touch, after which the zero padding of the last block is truncated.
+ * Filesystems that reject O_DIRECT (tmpfs) are opened buffered with the same access pattern.
+ */
+class DirectFile {
+public:
+    static constexpr size_t kAlignment = 4096;
+
+    DirectFile(const std::string& path, bool write, AsyncIo& io, size_t bufferSize, size_t depth)
+        : io_(io), write_(write), bufferSize_(alignUp(std::max<size_t>(bufferSize, 1))) {
+        const int flags = write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY;  // patches read back their block
+        fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if (fd_ < 0 && errno == EINVAL) fd_ = ::open(path.c_str(), flags, 0644);
+        if (fd_ < 0) throw std::runtime_error("Cannot open '" + path + "': " + std::strerror(errno));
+
+        buffers_.resize(std::max<size_t>(depth, 2));
+        for (Buffer& buffer : buffers_) {
+            void* memory = nullptr;
+            if (::posix_memalign(&memory, kAlignment, bufferSize_) != 0) {
+                releaseAll();
+                throw std::bad_alloc();
+            }
+            buffer.data.reset(static_cast<char*>(memory));
+        }
+        if (!write) {
+            struct stat info;
+            if (::fstat(fd_, &info) != 0) {
+                releaseAll();
+                throw std::runtime_error("Cannot stat '" + path + "'");
+            }
+            size_ = static_cast<uint64_t>(info.st_size);
+            for (Buffer& buffer : buffers_) startRead(buffer);
+        }
+
+        cookie_io_functions_t functions;
+        functions.read = write ? nullptr : &DirectFile::cookieRead;
+        functions.write = write ? &DirectFile::cookieWrite : nullptr;
+        functions.seek = &DirectFile::cookieSeek;
+        functions.close = nullptr;
+        stream_.reset(::fopencookie(this, write ? "w" : "r", functions));
+        if (!stream_) {
+            releaseAll();
+            throw std::runtime_error("fopencookie failed for '" + path + "'");
+        }
+        std::setvbuf(stream_.get(), nullptr, _IONBF, 0);
+    }
+
+    DirectFile(const DirectFile&) = delete;
+    DirectFile& operator=(const DirectFile&) = delete;
+
+    ~DirectFile() {
+        stream_.reset();
+        releaseAll();
+    }
+
+    std::FILE* stream() const { return stream_.get(); }
+
+    /**
+     * @brief Completes all writes, trims the padding and, if durable, fsyncs the file
+     */
+    void close(bool durable) {
+        if (fd_ < 0) return;
+        if (write_) {
+            if (!error_.empty()) throw std::runtime_error(error_);
+            Buffer& last = buffers_[current_];
+            if (last.length > 0) {
+                std::memset(last.data.get() + last.length, 0, alignUp(last.length) - last.length);
+                startWrite(last, alignUp(last.length));
+            }
+            for (Buffer& buffer : buffers_) finishWrite(buffer);
+            for (const auto& patch : patches_) applyPatch(patch.first, patch.second);
+            if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0) fail("ftruncate");
+            if (durable && ::fsync(fd_) != 0) fail("fsync");
+        }
+        releaseAll();
+    }
+
+private:
+    struct FreeDeleter {
+        void operator()(char* p) const { std::free(p); }
+    };
+
+    struct Buffer {
+        std::unique_ptr<char, FreeDeleter> data;
+        AsyncIo::Completion completion;
+        uint64_t offset = 0;
+        size_t length = 0;     ///< valid bytes (read) or bytes gathered so far (write)
+        size_t requested = 0;  ///< bytes in the request in flight
+    };
+
+    static size_t alignUp(size_t bytes) { return (bytes + kAlignment - 1) / kAlignment * kAlignment; }
+
+    [[noreturn]] void fail(const char* what) {
+        throw std::runtime_error(std::string("Direct I/O ") + what + " failed: " + std::strerror(errno));
+    }
+
+    void startWrite(Buffer& buffer, size_t bytes) {
+        buffer.offset = flushed_;
+        buffer.requested = bytes;
+        flushed_ += buffer.length;
+        io_.submit(true, fd_, buffer.data.get(), bytes, buffer.offset, buffer.completion);
+    }
+
+    void finishWrite(Buffer& buffer) {
+        io_.wait(buffer.completion);
+        if (buffer.requested > 0 && buffer.completion.result != static_cast<long>(buffer.requested)) {
+            errno = buffer.completion.result < 0 ? static_cast<int>(-buffer.completion.result) : EIO;
+            fail("write");
+        }
+        buffer.requested = 0;
+        buffer.length = 0;
+    }
+
+    void startRead(Buffer& buffer) {
+        buffer.length = 0;
+        buffer.requested = 0;
+        if (nextRead_ >= size_) return;
+        buffer.offset = nextRead_;
+        buffer.requested = bufferSize_;
+        nextRead_ += bufferSize_;
+        io_.submit(false, fd_, buffer.data.get(), bufferSize_, buffer.offset, buffer.completion);
+    }
+
+    size_t append(const char* data, size_t size) {
+        if (pos_ != size_) {
+            if (pos_ + size > size_) throw std::runtime_error("DirectFile only rewrites bytes already written");
+            if (pos_ >= flushed_) {
+                std::memcpy(buffers_[current_].data.get() + (pos_ - flushed_), data, size);
+            } else {
+                patches_.emplace_back(pos_, std::string(data, size));
+            }
+            pos_ += size;
+            return size;
+        }
+        for (size_t done = 0; done < size;) {
+            Buffer& buffer = buffers_[current_];
+            const size_t n = std::min(size - done, bufferSize_ - buffer.length);
+            std::memcpy(buffer.data.get() + buffer.length, data + done, n);
+            buffer.length += n;
+            done += n;
+            if (buffer.length == bufferSize_) {
+                startWrite(buffer, bufferSize_);
+                current_ = (current_ + 1) % buffers_.size();
+                finishWrite(buffers_[current_]);
+            }
+        }
+        size_ += size;
+        pos_ = size_;
+        return size;
+    }
+
+    size_t readInto(char* out, size_t size) {
+        size_t copied = 0;
+        while (copied < size && pos_ < size_) {
+            Buffer& buffer = buffers_[current_];
+            if (buffer.requested > 0) {
+                io_.wait(buffer.completion);
+                const uint64_t expected = std::min<uint64_t>(buffer.requested, size_ - buffer.offset);
+                if (buffer.completion.result < 0 || static_cast<uint64_t>(buffer.completion.result) < expected) {
+                    errno = buffer.completion.result < 0 ? static_cast<int>(-buffer.completion.result) : EIO;
+                    fail("read");
+                }
+                buffer.length = static_cast<size_t>(expected);
+                buffer.requested = 0;
+            }
+            const size_t at = static_cast<size_t>(pos_ - buffer.offset);
+            const size_t n = std::min(size - copied, buffer.length - at);
+            std::memcpy(out + copied, buffer.data.get() + at, n);
+            copied += n;
+            pos_ += n;
+            if (at + n == buffer.length) {
+                startRead(buffer);
+                current_ = (current_ + 1) % buffers_.size();
+            }
+        }
+        return copied;
+    }
+
+    void applyPatch(uint64_t offset, const std::string& bytes) {
+        const uint64_t first = offset / kAlignment * kAlignment;
+        const size_t span = alignUp(static_cast<size_t>(offset - first) + bytes.size());
+        char* block = buffers_[0].data.get();
+        if (span > bufferSize_) throw std::runtime_error("DirectFile patch spans more than one buffer");
+        if (::pread(fd_, block, span, static_cast<off_t>(first)) != static_cast<ssize_t>(span)) fail("patch read");
+        std::memcpy(block + (offset - first), bytes.data(), bytes.size());
+        if (::pwrite(fd_, block, span, static_cast<off_t>(first)) != static_cast<ssize_t>(span)) fail("patch write");
+    }
+
+    /**
+     * @brief Waits for every request still in flight, then closes the descriptor
+     */
+    void releaseAll() {
+        for (Buffer& buffer : buffers_) io_.wait(buffer.completion);
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    static ssize_t cookieWrite(void* self, const char* data, size_t size) {
+        DirectFile& file = *static_cast<DirectFile*>(self);
+        try {
+            return static_cast<ssize_t>(file.append(data, size));
+        } catch (const std::exception& e) {
+            file.error_ = e.what();
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    static ssize_t cookieRead(void* self, char* data, size_t size) {
+        DirectFile& file = *static_cast<DirectFile*>(self);
+        try {
+            return static_cast<ssize_t>(file.readInto(data, size));
+        } catch (const std::exception& e) {
+            file.error_ = e.what();
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    static int cookieSeek(void* self, off64_t* offset, int whence) {
+        DirectFile& file = *static_cast<DirectFile*>(self);
+        const int64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? static_cast<int64_t>(file.pos_)
+                                                                          : static_cast<int64_t>(file.size_);
+        const int64_t target = base + *offset;
+        // Reads only stream forwards; writes may revisit anything already written
+        if (target < 0 || target > static_cast<int64_t>(file.size_) ||
+            (!file.write_ && static_cast<uint64_t>(target) != file.pos_)) {
+            errno = EINVAL;
+            return -1;
+        }
+        file.pos_ = static_cast<uint64_t>(target);
+        *offset = target;
+        return 0;
+    }
+
+    AsyncIo& io_;
+    const bool write_;
+    const size_t bufferSize_;
+    int fd_ = -1;
+    std::vector<Buffer> buffers_;
+    size_t current_ = 0;
+    uint64_t size_ = 0;      ///< bytes written so far, or the file size when reading
+    uint64_t pos_ = 0;       ///< stream position
+    uint64_t flushed_ = 0;   ///< bytes handed to write requests
+    uint64_t nextRead_ = 0;  ///< offset of the next read-ahead request
+    std::vector<std::pair<uint64_t, std::string>> patches_;
+    std::string error_;
+    FileHandle stream_;
+};
+#endif
+
+/**
+ * @class RunFile
+ * @brief A run file opened through the chosen IoBackend, used through its FILE*
+ */
+class RunFile {
+public:
+    RunFile() = default;
+
+    RunFile(const std::string& path, bool write, IoBackend backend, AsyncIo* io, size_t bufferSize) {
+#ifdef SORTING_DIRECT_IO
+        if (backend == IoBackend::Direct && io) {
+            // Reads keep several requests in flight per file; writes double-buffer
+            const size_t depth = write ? 2 : 4;
+            direct_.reset(new DirectFile(path, write, *io, bufferSize / depth, depth));
+            return;
+        }
+#else
+        (void)backend;
+        (void)io;
+        (void)bufferSize;
+#endif
+        stdio_ = openFile(path, write ? "wb" : "rb");
+        // BinaryReader/BinaryWriter buffer already; a second stdio buffer per run would escape the budget
+        std::setvbuf(stdio_.get(), nullptr, _IONBF, 0);
+    }
+
+    std::FILE* get() const {
+#ifdef SORTING_DIRECT_IO
+        if (direct_) return direct_->stream();
+#endif
+        return stdio_.get();
+    }
+
+    /**
+     * @brief Completes pending writes; durable also forces the data to stable storage
+     */
+    void close(bool durable) {
+#ifdef SORTING_DIRECT_IO
+        if (direct_) return direct_->close(durable);
+#endif
+        if (durable) {
+            detail::syncFile(stdio_.get());
+        } else if (std::fflush(stdio_.get()) != 0) {
+            throw std::runtime_error("Cannot flush run file");
+        }
+    }
+
+    /**
+     * @brief True when this platform can open files with IoBackend::Direct
+     */
+    static bool directSupported() {
+#ifdef SORTING_DIRECT_IO
+        return true;
+#else
+        return false;
+#endif
+    }
+
+private:
+    FileHandle stdio_;
+#ifdef SORTING_DIRECT_IO
+    std::unique_ptr<DirectFile> direct_;
+#endif
+};
+
+} // namespace io
+
+/**
+ * @brief How ExternalSort turns its input into sorted runs (ExternalSortOptions::runGeneration)
+ */
+enum class RunGeneration {
+    SortedChunks,         ///< sort chunks of half the budget (the sort's scratch takes the other half)
+    ReplacementSelection  ///< stream through a selection heap; ~2x budget on random input
+};
+
+/**
+ * @brief Tuning knobs for ExternalSort
+ */
+struct ExternalSortOptions {
+    size_t memoryBudget = size_t(64) << 20;                ///< bytes of values and sort scratch held in memory
+    RunGeneration runGeneration = RunGeneration::SortedChunks;  ///< sorted chunks or replacement selection
+    size_t sortThreads = 1;  ///< SortedChunks sorters; above 1, reading, sorting and writing overlap; 0: all cores
+    std::string tempDirectory;                             ///< empty: the system temporary directory
+    io::Encoding runEncoding = io::Encoding::BlockPacked;  ///< encoding of spilled run files
+    size_t mergeFanIn = 64;  ///< maximum runs merged at once; lowered when their buffers would not fit memoryBudget
+    std::string jobDirectory;                              ///< non-empty: checkpoint here and resume from it
+    io::IoBackend ioBackend = io::IoBackend::Stdio;        ///< how run files are read and written
+    Executor* executor = nullptr;  ///< runs pipelined chunk sorts; null: the default executor, else sortThreads threads
+};
+
+/**
+ * @brief Counters collected by the most recent ExternalSort::sort call
+ */
+struct ExternalSortStats {
+    uint64_t values = 0;
+    uint64_t runs = 0;
+    uint64_t mergePasses = 0;
+    uint64_t rawSpillBytes = 0;   ///< size the spilled values would take as fixed-width integers
+    uint64_t spilledBytes = 0;    ///< bytes actually written to run files, all passes included
+    uint64_t resumedRuns = 0;     ///< runs recovered from a checkpoint instead of being rebuilt
+    uint64_t skippedValues = 0;   ///< input values already covered by recovered runs
+    uint64_t shortestRun = 0;     ///< values in the shortest run formed by this call
+    uint64_t longestRun = 0;      ///< values in the longest run formed by this call
+    double runFormationMs = 0;
+    double mergeMs = 0;
+    uint64_t peakMemoryBytes = 0; ///< largest sum of chunk, reader, writer and file buffers held at once
+    const char* ioBackend = "stdio";  ///< "stdio", "io_uring" or "pread" (the latter two with O_DIRECT)
+
+    double compressionRatio() const {
+        return spilledBytes ? static_cast<double>(rawSpillBytes) / static_cast<double>(spilledBytes) : 1.0;
+    }
+
+    double averageRunLength() const {
+        return runs > resumedRuns ? static_cast<double>(values - skippedValues) / static_cast<double>(runs - resumedRuns) : 0.0;
+    }
+};
+
+/**
+ * @class ExternalSort
+ * @brief Sorts integer streams larger than memory by spilling sorted runs to disk
+ *
+ * Input is read from a Source (`bool next(T&)`) in memory-budget sized chunks, each chunk
+ * is sorted with QuadMergeSort and written as a run file in the binary value format, and
+ * the runs are k-way merged into a Sink (`write(T)`), in several passes if there are more
+ * runs than the merge fan-in. Inputs that fit the budget never touch the disk. With
+ * RunGeneration::ReplacementSelection the first full chunk instead seeds a heap that
+ * streams the rest of the input into runs longer than the budget. With several sortThreads,
+ * sorted-chunk runs are formed by a read/sort/write pipeline instead (formRunsPipelined).
+ *
+ * With a jobDirectory the sort is restartable: every finished run file is fsynced before
+ * it is recorded in a manifest, and the manifest is replaced atomically (write, fsync,
+ * rename, fsync directory). A restarted sort given the same input reloads the manifest,
+ * skips the input already covered by recorded runs, and continues from the last
+ * completed run or merge group; only the final merge into the sink is always redone.
+ * Run files in the job directory that the manifest does not list are deleted on resume.
+ * Replacement-selection runs do not cover an input prefix, so they are recorded only
+ * once the input is exhausted.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class ExternalSort {
+public:
+    explicit ExternalSort(ExternalSortOptions options = ExternalSortOptions(), Comparator comp = Comparator())
+        : options_(std::move(options)), comp_(comp) {
+        if (options_.mergeFanIn < 2) throw std::invalid_argument("ExternalSort merge fan-in must be at least 2");
+        if (options_.tempDirectory.empty()) options_.tempDirectory = std::filesystem::temp_directory_path().string();
+        if (options_.ioBackend == io::IoBackend::Direct && io::RunFile::directSupported()) asyncIo_.reset(new io::AsyncIo());
+    }
+
+    ExternalSort(const ExternalSort&) = delete;
+    ExternalSort& operator=(const ExternalSort&) = delete;
+
+    ~ExternalSort() {
+        // Checkpointed runs are kept on failure so that a later sort can resume from them
+        if (!checkpointed()) removeRuns(runs_);
+    }
+
+    template<typename Source, typename Sink>
+    void sort(Source& input, Sink& output) {
+        stats_ = ExternalSortStats();
+        if (asyncIo_) stats_.ioBackend = asyncIo_->usesRing() ? "io_uring" : "pread";
+        if (checkpointed()) {
+            loadManifest();
+        } else {
+            removeRuns(runs_);
+            consumed_ = 0;
+            inputComplete_ = false;
+        }
+        const auto start = std::chrono::steady_clock::now();
+
+        if (!inputComplete_) {
+            T value;
+            for (; stats_.skippedValues < consumed_; ++stats_.skippedValues) {
+                if (!input.next(value)) throw std::runtime_error("Input is shorter than the checkpointed job");
+            }
+            stats_.values = consumed_;
+
+            const bool replacement = options_.runGeneration == RunGeneration::ReplacementSelection;
+            const size_t sorters = replacement ? 1 : sortThreads();
+            const size_t buffers = sorters > 1 ? sorters + 2 : 1;
+            // Each chunk being sorted needs as much scratch again: the sequential sort one,
+            // the pipeline at most one per sorter plus one for the helping reader
+            const size_t scratch = replacement ? 0 : sorters > 1 ? sorters + 1 : 1;
+            const size_t capacity = std::max<size_t>(1, dataBudgetBytes() / (buffers + scratch) / sizeof(T));
+            std::vector<T> chunk;
+            chunk.reserve(std::min<size_t>(capacity, size_t(1) << 20));
+            while (input.next(value)) {
+                // Grow geometrically but never past the budgeted capacity
+                if (chunk.size() == chunk.capacity()) chunk.reserve(std::min(capacity, 2 * chunk.capacity()));
+                chunk.push_back(value);
+                ++stats_.values;
+                if (chunk.size() < capacity) continue;
+                if (replacement || buffers > 1) {
+                    if (replacement) {
+                        replacementSelection(chunk, input);
+                    } else {
+                        formRunsPipelined(chunk, input, sorters, capacity);
+                    }
+                    chunk.clear();
+                    break;
+                }
+                spill(chunk);
+            }
+
+            // A replacement-selection chunk may be too large to sort next to its scratch;
+            // then the heap writes it out as a single run instead
+            if (runs_.empty() && replacement && (chunk.capacity() + chunk.size()) * sizeof(T) > dataBudgetBytes()) {
+                replacementSelection(chunk, input);
+                chunk.clear();
+            }
+            if (runs_.empty()) {
+                notePeak((chunk.capacity() + chunk.size()) * sizeof(T));
+                QuadMergeSort<T, Comparator>::sort(chunk, comp_);
+                for (const T& v : chunk) output.write(v);
+                stats_.runFormationMs = elapsedMs(start);
+                finishJob();
+                return;
+            }
+            if (!chunk.empty()) spill(chunk);
+            inputComplete_ = true;
+            saveManifest(runs_);
+        } else {
+            stats_.values = stats_.skippedValues = consumed_;
+        }
+        stats_.runs = runs_.size();
+        const auto merging = std::chrono::steady_clock::now();
+        stats_.runFormationMs = std::chrono::duration<double, std::milli>(merging - start).count();
+
+        while (runs_.size() > fanIn()) {
+            std::vector<std::string> next;
+            try {
+                mergePass(next);
+            } catch (...) {
+                if (!checkpointed()) removeRuns(next);
+                throw;
+            }
+            runs_.swap(next);
+            ++stats_.mergePasses;
+        }
+
+        mergeRuns(runs_, output, false);
+        ++stats_.mergePasses;
+        finishJob();
+        stats_.mergeMs = elapsedMs(merging);
+    }
+
+    const ExternalSortStats& stats() const { return stats_; }
+    const ExternalSortOptions& options() const { return options_; }
+
+private:
+    // Deltas of ascending runs are non-negative, which the binary format stores unsigned
+    static constexpr bool kAscending = std::is_same<Comparator, std::less<T>>::value;
+    static constexpr size_t kMinMergeBuffer = size_t(1) << 10;
+
+    /**
+     * @brief Reads one run file; owns the FILE so the source can be moved into a RunMerger
+     */
+    class RunFileSource {
+    public:
+        RunFileSource(io::RunFile file, size_t bufferSize)
+            : file_(std::move(file)), reader_(new io::BinaryReader<T>(file_.get(), bufferSize)) {}
+
+        bool next(T& value) { return reader_->next(value); }
+
+    private:
+        io::RunFile file_;
+        std::unique_ptr<io::BinaryReader<T>> reader_;
+    };
+
+    /**
+     * @brief Merges groups of fanIn() runs into new run files listed in next
+     */
+    void mergePass(std::vector<std::string>& next) {
+        const size_t groupSize = fanIn();
+        for (size_t first = 0; first < runs_.size(); first += groupSize) {
+            const size_t last = std::min(runs_.size(), first + groupSize);
+            std::vector<std::string> group(runs_.begin() + first, runs_.begin() + last);
+            if (group.size() == 1) {
+                next.push_back(group[0]);
+                continue;
+            }
+            const std::string path = newRunPath();
+            next.push_back(path);
+            io::RunFile file = openRun(path, true, ioBufferBytes());
+            io::BinaryWriter<T> writer(file.get(), options_.runEncoding, kAscending,
+                                       io::BinaryHeader::kUnknownCount, ioBufferBytes());
+            mergeRuns(group, writer, true);
+            finishRun(writer, file);
+
+            std::vector<std::string> live = next;
+            live.insert(live.end(), runs_.begin() + last, runs_.end());
+            saveManifest(live);
+            removeRuns(group);
+        }
+    }
+
+    void spill(std::vector<T>& chunk) {
+        notePeak((chunk.capacity() + chunk.size()) * sizeof(T));
+        QuadMergeSort<T, Comparator>::sort(chunk, comp_);
+        writeRun(chunk);
+    }
+
+    void writeRun(std::vector<T>& chunk) {
+        const std::string path = newRunPath();
+        runs_.push_back(path);
+        io::RunFile file = openRun(path, true, ioBufferBytes());
+        io::BinaryWriter<T> writer(file.get(), options_.runEncoding, kAscending, chunk.size(), ioBufferBytes());
+        notePeak(chunk.capacity() * sizeof(T) + writerBytes());
+        for (const T& v : chunk) writer.write(v);
+        finishRun(writer, file);
+        noteRunLength(chunk.size());
+        consumed_ += chunk.size();
+        saveManifest(runs_);
+        chunk.clear();
+    }
+
+    Executor* executor() const {
+        return options_.executor ? options_.executor : defaultExecutor();
+    }
+
+    size_t sortThreads() const {
+        if (options_.sortThreads) return options_.sortThreads;
+        if (executor()) return std::max<size_t>(1, executor()->concurrency());
+        const ConcurrencyLimits limits = concurrencyLimits();
+        return limits.threadsFor(std::thread::hardware_concurrency(), limits.workerCpus());
+    }
+
+    /**
+     * @brief Forms sorted-chunk runs with reading, sorting and writing overlapped
+     *
+     * The calling thread keeps reading chunks while the executor sorts earlier ones with
+     * QuadMergeSort and a writer thread spills them in input order, so run formation runs
+     * at the speed of the slowest stage. sorters + 2 chunk buffers cycle through the stages
+     * (one filling, one writing, one per sorter); the reader waits when none is free, which
+     * together with the sorts' scratch (at most sorters + 1 chunks) keeps the pipeline
+     * inside the budget. Before waiting, the reader sorts any chunk the executor has not
+     * picked up yet.
+     */
+    template<typename Source>
+    void formRunsPipelined(std::vector<T>& first, Source& input, size_t sorters, size_t capacity) {
+        notePeak((2 * sorters + 3) * capacity * sizeof(T) + writerBytes());
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::pair<uint64_t, std::vector<T>>> unsorted;
+        std::map<uint64_t, std::vector<T>> sorted;
+        std::vector<std::vector<T>> spare;
+        size_t unallocated = sorters + 1;
+        uint64_t submitted = 0;
+        bool inputDone = false;
+        std::exception_ptr error;
+
+        auto fail = [&]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+            changed.notify_all();
+        };
+        auto sortOne = [&]() {
+            std::pair<uint64_t, std::vector<T>> task;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (error || unsorted.empty()) return;
+                task = std::move(unsorted.front());
+                unsorted.pop_front();
+            }
+            try {
+                QuadMergeSort<T, Comparator>::sort(task.second, comp_);
+            } catch (...) {
+                return fail();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            sorted.emplace(task.first, std::move(task.second));
+            changed.notify_all();
+        };
+        auto writeLoop = [&]() {
+            for (uint64_t next = 0;; ++next) {
+                std::vector<T> chunk;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() {
+                        return error || sorted.count(next) || (inputDone && next == submitted);
+                    });
+                    if (error || !sorted.count(next)) return;
+                    chunk = std::move(sorted[next]);
+                    sorted.erase(next);
+                }
+                try {
+                    writeRun(chunk);
+                } catch (...) {
+                    return fail();
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                spare.push_back(std::move(chunk));
+                changed.notify_all();
+            }
+        };
+
+        std::unique_ptr<ThreadPool> pool;
+        Executor* sortExecutor = executor();
+        if (!sortExecutor) {
+            pool.reset(new ThreadPool(sorters));
+            sortExecutor = pool.get();
+        }
+        std::thread writer(writeLoop);
+        {
+            detail::TaskGroup sorts(*sortExecutor);
+            try {
+                std::vector<T> chunk = std::move(first);
+                T value;
+                for (;;) {
+                    const bool full = chunk.size() == capacity;
+                    if (!chunk.empty()) {
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            unsorted.emplace_back(submitted++, std::move(chunk));
+                        }
+                        sorts.run(sortOne);
+                    }
+                    if (!full) break;
+                    while (sorts.runOne()) {
+                    }
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return error || unallocated > 0 || !spare.empty(); });
+                        if (error) break;
+                        if (spare.empty()) {
+                            --unallocated;
+                            chunk = std::vector<T>();
+                            chunk.reserve(capacity);
+                        } else {
+                            chunk = std::move(spare.back());
+                            spare.pop_back();
+                        }
+                    }
+                    while (chunk.size() < capacity && input.next(value)) {
+                        chunk.push_back(value);
+                        ++stats_.values;
+                    }
+                }
+            } catch (...) {
+                fail();
+            }
+            sorts.wait();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            inputDone = true;
+            changed.notify_all();
+        }
+        writer.join();
+        if (error) std::rethrow_exception(error);
+    }
+
+    /**
+     * @brief Writes runs by replacement selection, seeded with a full chunk
+     *
+     * Each value written is replaced by the next input value, which stays in the current
+     * run's heap unless it sorts before the value just written; then it is parked behind
+     * the heap for the next run. The heap and the parked values share the chunk, so run
+     * formation needs no memory beyond the budget.
+     */
+    template<typename Source>
+    void replacementSelection(std::vector<T>& chunk, Source& input) {
+        // chunk[0, live) is the current run's heap, chunk[live, end) the values parked for the next
+        auto after = [this](const T& a, const T& b) { return comp_(b, a); };
+        size_t end = chunk.size();
+        size_t live = 0;
+        notePeak(chunk.capacity() * sizeof(T) + writerBytes());
+
+        io::RunFile file;
+        std::unique_ptr<io::BinaryWriter<T>> writer;
+        bool more = true;
+        T value;
+        while (end > 0) {
+            if (live == 0) {
+                if (writer) {
+                    finishRun(*writer, file);
+                    noteRunLength(writer->count());
+                }
+                live = end;
+                std::make_heap(chunk.begin(), chunk.begin() + live, after);
+                const std::string path = newRunPath();
+                runs_.push_back(path);
+                writer.reset();
+                file = openRun(path, true, ioBufferBytes());
+                writer.reset(new io::BinaryWriter<T>(file.get(), options_.runEncoding, kAscending,
+                                                     io::BinaryHeader::kUnknownCount, ioBufferBytes()));
+            }
+            std::pop_heap(chunk.begin(), chunk.begin() + live, after);
+            const T out = chunk[live - 1];
+            writer->write(out);
+
+            if (more) more = input.next(value);
+            if (more) {
+                ++stats_.values;
+                if (comp_(value, out)) {
+                    chunk[--live] = value;
+                } else {
+                    chunk[live - 1] = value;
+                    std::push_heap(chunk.begin(), chunk.begin() + live, after);
+                }
+            } else {
+                // Close the gap at live - 1 with the last parked value
+                chunk[--live] = chunk[--end];
+            }
+        }
+        finishRun(*writer, file);
+        noteRunLength(writer->count());
+        consumed_ = stats_.values;
+    }
+
+    void noteRunLength(uint64_t length) {
+        stats_.shortestRun = stats_.shortestRun ? std::min(stats_.shortestRun, length) : length;
+        stats_.longestRun = std::max(stats_.longestRun, length);
+    }
+
+    /**
+     * @brief Opens a run file through the configured backend with about bufferSize bytes of buffers
+     */
+    io::RunFile openRun(const std::string& path, bool write, size_t bufferSize) {
+        return io::RunFile(path, write, options_.ioBackend, asyncIo_.get(), bufferSize);
+    }
+
+    void finishRun(io::BinaryWriter<T>& writer, io::RunFile& file) {
+        writer.finish();
+        file.close(checkpointed());
+        stats_.rawSpillBytes += writer.count() * sizeof(T);
+        stats_.spilledBytes += writer.bytesWritten();
+    }
+
+    bool checkpointed() const { return !options_.jobDirectory.empty(); }
+
+    std::string manifestPath() const {
+        return (std::filesystem::path(options_.jobDirectory) / "manifest").string();
+    }
+
+    /**
+     * @brief Atomically replaces the manifest with the given live runs and input progress
+     */
+    void saveManifest(const std::vector<std::string>& live) {
+        if (!checkpointed()) return;
+        std::ostringstream text;
+        text << "mergesort-manifest 1\n"
+             << "type " << int(io::BinaryHeader::typeCode<T>()) << "\n"
+             << "encoding " << int(options_.runEncoding) << "\n"
+             << "consumed " << consumed_ << "\n"
+             << "input-complete " << (inputComplete_ ? 1 : 0) << "\n"
+             << "next-run " << nextRunId_ << "\n";
+        for (const auto& path : live) text << "run " << std::filesystem::path(path).filename().string() << "\n";
+
+        const std::string temporary = manifestPath() + ".tmp";
+        {
+            io::FileHandle file = io::openFile(temporary, "wb");
+            const std::string bytes = text.str();
+            if (std::fwrite(bytes.data(), 1, bytes.size(), file.get()) != bytes.size()) {
+                throw std::runtime_error("Cannot write checkpoint manifest '" + temporary + "'");
+            }
+            detail::syncFile(file.get());
+        }
+        std::filesystem::rename(temporary, manifestPath());
+        detail::syncDirectory(options_.jobDirectory);
+    }
+
+    /**
+     * @brief Restores runs and progress from the job manifest, or starts a fresh job
+     */
+    void loadManifest() {
+        runs_.clear();
+        consumed_ = 0;
+        inputComplete_ = false;
+        nextRunId_ = 0;
+        std::filesystem::create_directories(options_.jobDirectory);
+
+        std::ifstream in(manifestPath());
+        if (!in) return removeOrphanRuns();
+        std::string line;
+        if (!std::getline(in, line) || line != "mergesort-manifest 1") {
+            throw std::runtime_error("Unrecognized checkpoint manifest '" + manifestPath() + "'");
+        }
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string key;
+            fields >> key;
+            if (key == "run") {
+                std::string name;
+                fields >> name;
+                const std::string path = (std::filesystem::path(options_.jobDirectory) / name).string();
+                if (!std::filesystem::exists(path)) {
+                    throw std::runtime_error("Checkpointed run file '" + path + "' is missing");
+                }
+                runs_.push_back(path);
+            } else {
+                uint64_t number = 0;
+                fields >> number;
+                if (key == "type" && number != io::BinaryHeader::typeCode<T>()) {
+                    throw std::runtime_error("Checkpoint was written for a different value type");
+                } else if (key == "encoding" && number != static_cast<uint64_t>(options_.runEncoding)) {
+                    throw std::runtime_error("Checkpoint was written with a different run encoding");
+                } else if (key == "consumed") {
+                    consumed_ = number;
+                } else if (key == "input-complete") {
+                    inputComplete_ = number != 0;
+                } else if (key == "next-run") {
+                    nextRunId_ = number;
+                }
+            }
+        }
+        stats_.resumedRuns = runs_.size();
+        removeOrphanRuns();
+    }
+
+    /**
+     * @brief Deletes run files in the job directory that the manifest does not list
+     *
+     * A merge group's inputs are removed only after the manifest stops listing them, so a
+     * crash in between leaves them behind; so does a crash before a new run is recorded.
+     */
+    void removeOrphanRuns() {
+        std::vector<std::string> live;
+        for (const auto& path : runs_) live.push_back(std::filesystem::path(path).filename().string());
+        std::error_code ignored;
+        for (const auto& entry : std::filesystem::directory_iterator(options_.jobDirectory, ignored)) {
+            const std::string name = entry.path().filename().string();
+            const bool runFile = name.compare(0, 4, "run-") == 0 && name.size() > 8 &&
+                                 name.compare(name.size() - 4, 4, ".run") == 0;
+            if (runFile && std::find(live.begin(), live.end(), name) == live.end()) {
+                std::filesystem::remove(entry.path(), ignored);
+            }
+        }
+    }
+
+    /**
+     * @brief Removes run files and, for checkpointed jobs, the manifest once output is complete
+     */
+    void finishJob() {
+        removeRuns(runs_);
+        if (checkpointed()) {
+            std::error_code ignored;
+            std::filesystem::remove(manifestPath(), ignored);
+        }
+        consumed_ = 0;
+        inputComplete_ = false;
+    }
+
+    /**
+     * @brief Size of each run writer's buffer: an eighth of the budget, within [1 KiB, 1 MiB]
+     */
+    size_t ioBufferBytes() const {
+        return std::min<size_t>(size_t(1) << 20, std::max<size_t>(size_t(1) << 10, options_.memoryBudget / 8));
+    }
+
+    size_t dataBudgetBytes() const {
+        return options_.memoryBudget > writerBytes() ? options_.memoryBudget - writerBytes() : 0;
+    }
+
+    /**
+     * @brief Aligned read-ahead or write-behind buffers of an O_DIRECT run file; stdio run
+     * files are unbuffered
+     */
+    size_t fileBufferBytes(size_t bufferSize, size_t depth) const {
+        if (!asyncIo_) return 0;
+        const size_t alignment = 4096;  // DirectFile rounds each buffer up to this
+        return depth * ((std::max<size_t>(bufferSize / depth, 1) + alignment - 1) / alignment * alignment);
+    }
+
+    /**
+     * @brief Memory of one run writer: its buffer, pending block and file buffers
+     */
+    size_t writerBytes() const {
+        return sizeof(io::BinaryWriter<T>) + ioBufferBytes() + fileBufferBytes(ioBufferBytes(), 2);
+    }
+
+    /**
+     * @brief Memory of one input run of a merge opened with bufferSize: reader buffer and
+     * decoded block, file buffers and the merge heap entry
+     */
+    size_t readerBytes(size_t bufferSize) const {
+        return sizeof(RunFileSource) + sizeof(io::BinaryReader<T>) + readerBufferBytes(bufferSize) +
+               fileBufferBytes(bufferSize, 4) + sizeof(T) + sizeof(size_t);
+    }
+
+    size_t readerBufferBytes(size_t bufferSize) const {
+        // Direct reads stage data in the run file's read-ahead buffers; the reader only needs a block
+        return asyncIo_ ? size_t(4) << 10 : bufferSize;
+    }
+
+    /**
+     * @brief Runs merged at once: mergeFanIn, lowered until every input run with the
+     * smallest buffer plus the output writer fits the budget (but at least 2)
+     */
+    size_t fanIn() const {
+        const size_t room = options_.memoryBudget > writerBytes() ? options_.memoryBudget - writerBytes() : 0;
+        return std::max<size_t>(2, std::min(options_.mergeFanIn, room / readerBytes(kMinMergeBuffer)));
+    }
+
+    void notePeak(size_t bytes) {
+        stats_.peakMemoryBytes = std::max<uint64_t>(stats_.peakMemoryBytes, bytes);
+    }
+
+    /**
+     * @brief Merges runs into sink; intoRun counts the run writer the sink belongs to
+     */
+    template<typename Sink>
+    void mergeRuns(const std::vector<std::string>& paths, Sink& sink, bool intoRun) {
+        // The largest buffer, up to 1 MiB, that lets every input run fit its share of the budget
+        const size_t output = intoRun ? writerBytes() : 0;
+        const size_t share = options_.memoryBudget > output ? (options_.memoryBudget - output) / paths.size() : 0;
+        size_t bufferSize = kMinMergeBuffer;
+        for (size_t high = size_t(1) << 20; bufferSize < high;) {
+            const size_t middle = bufferSize + (high - bufferSize + 1) / 2;
+            if (readerBytes(middle) <= share) {
+                bufferSize = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+        notePeak(readerBytes(bufferSize) * paths.size() + output);
+        std::vector<RunFileSource> sources;
+        sources.reserve(paths.size());
+        for (const auto& path : paths) {
+            sources.emplace_back(openRun(path, false, bufferSize), readerBufferBytes(bufferSize));
+        }
+
+        RunMerger<T, RunFileSource, Comparator> merger(std::move(sources), comp_);
+        T value;
+        while (merger.next(value)) sink.write(value);
+    }
+
+    std::string newRunPath() {
+        if (checkpointed()) {
+            const std::string name = "run-" + std::to_string(nextRunId_++) + ".run";
+            return (std::filesystem::path(options_.jobDirectory) / name).string();
+        }
+        static std::atomic<uint64_t> sequence(0);
+#ifdef SORTING_POSIX
+        const long pid = static_cast<long>(::getpid());
+#else
+        const long pid = 0;
+#endif
+        const std::string name = "mergesort-" + std::to_string(pid) + "-" + std::to_string(sequence++) + ".run";
+        return (std::filesystem::path(options_.tempDirectory) / name).string();
+    }
+
+    static void removeRuns(std::vector<std::string>& paths) {
+        for (const auto& path : paths) {
+            std::error_code ignored;
+            std::filesystem::remove(path, ignored);
+        }
+        paths.clear();
+    }
+
+    static double elapsedMs(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    ExternalSortOptions options_;
+    Comparator comp_;
+    std::vector<std::string> runs_;
+    ExternalSortStats stats_;
+    uint64_t consumed_ = 0;
+    bool inputComplete_ = false;
+    uint64_t nextRunId_ = 0;
+    std::unique_ptr<io::AsyncIo> asyncIo_;
+};
+
+/**
+ * @brief Merge strategies BoundedMergeSort chooses from, in order of preference
+ */
+enum class MergeStrategy {
+    Buffered,      ///< ping-pong merge with an n-element scratch buffer
+    HalfBuffer,    ///< merges by moving only the left half out, n/2-element buffer
+    InPlace,       ///< rotation-based merge, no heap scratch, O(n log^2 n) time
+    ExternalSpill  ///< sorted runs spilled to disk and merged back (integral types only)
+};
+
+inline const char* toString(MergeStrategy strategy) {
+    switch (strategy) {
+    case MergeStrategy::Buffered: return "buffered";
+    case MergeStrategy::HalfBuffer: return "half-buffer";
+    case MergeStrategy::InPlace: return "in-place";
+    case MergeStrategy::ExternalSpill: return "external-spill";
+    }
+    return "unknown";
+}
+
+struct MergeSortOptions {
+    size_t memoryLimit = 0;      ///< maximum scratch bytes the sort may allocate; 0 means unlimited
+    std::string spillDirectory;  ///< non-empty: allow ExternalSpill, writing runs here
+};
+
+struct MergeSortReport {
+    MergeStrategy strategy = MergeStrategy::Buffered;
+    size_t peakBytes = 0;  ///< largest scratch the sort allocated at once (for ExternalSpill, ExternalSort's peak)
+};
+
+/**
+ * @class BoundedMergeSort
+ * @brief Stable merge sort whose scratch memory never exceeds a byte limit
+ *
+ * The strategy is chosen up front from the limit: a full buffer if n elements fit, a
+ * half buffer if n/2 fit, otherwise an external spill (when allowed and T is integral)
+ * or the in-place merge, which needs no heap memory at all.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class BoundedMergeSort {
+public:
+    static MergeSortReport sort(std::vector<T>& arr, const MergeSortOptions& options,
+                                Comparator comp = Comparator()) {
+        MergeSortReport report;
+        const size_t n = arr.size();
+        report.strategy = choose(n, options);
+        if (n <= 1) return report;
+
+        switch (report.strategy) {
+        case MergeStrategy::Buffered: {
+            detail::RawBuffer<T> buffer(n);
+            report.peakBytes = buffer.bytes();
+            sortBuffered(arr.data(), n, buffer, comp);
+            break;
+        }
+        case MergeStrategy::HalfBuffer: {
+            detail::RawBuffer<T> buffer((n + 1) / 2);
+            report.peakBytes = buffer.bytes();
+            sortHalfBuffer(arr.data(), n, buffer.get(), comp);
+            break;
+        }
+        case MergeStrategy::InPlace:
+            sortInPlace(arr.data(), n, comp);
+            break;
+        case MergeStrategy::ExternalSpill:
+            report.peakBytes = spill(arr, options, comp);
+            break;
+        }
+        return report;
+    }
+
+    static MergeStrategy choose(size_t n, const MergeSortOptions& options) {
+        const size_t limit = options.memoryLimit;
+        if (limit == 0 || n * sizeof(T) <= limit) return MergeStrategy::Buffered;
+        if ((n + 1) / 2 * sizeof(T) <= limit) return MergeStrategy::HalfBuffer;
+        if (std::is_integral<T>::value && !options.spillDirectory.empty() && limit >= kMinSpillBytes) {
+            return MergeStrategy::ExternalSpill;
+        }
+        return MergeStrategy::InPlace;
+    }
+
+private:
+    static constexpr size_t kRunSize = 32;
+    static constexpr size_t kMinSpillBytes = size_t(64) << 10;
+
+    static void sortRuns(T* arr, size_t n, Comparator& comp) {
+        for (size_t start = 0; start < n; start += kRunSize) {
+            detail::insertionSort(arr + start, std::min(kRunSize, n - start), comp);
+        }
+    }
+
+    /**
+     * @brief Ping-pong merge through buffer; the first level constructs its values, later
+     * levels assign
+     */
+    static void sortBuffered(T* arr, size_t n, detail::RawBuffer<T>& buffer, Comparator& comp) {
+        sortRuns(arr, n, comp);
+        T* src = arr;
+        T* dst = buffer.get();
+        for (size_t width = kRunSize; width < n; width *= 2) {
+            const bool constructed = width > kRunSize;
+            for (size_t low = 0; low < n; low += 2 * width) {
+                const size_t mid = std::min(n, low + width);
+                const size_t high = std::min(n, low + 2 * width);
+                if (constructed) {
+                    detail::mergeMove<false>(src + low, src + mid, src + mid, src + high, dst + low, comp);
+                    continue;
+                }
+                try {
+                    detail::mergeMove<true>(src + low, src + mid, src + mid, src + high, dst + low, comp);
+                } catch (...) {
+                    std::destroy(dst, dst + low);  // the merges before this one completed
+                    throw;
+                }
+            }
+            if (!constructed) buffer.markConstructed();
+            std::swap(src, dst);
+        }
+        if (src != arr) std::move(src, src + n, arr);
+    }
+
+    static void sortHalfBuffer(T* arr, size_t n, T* buffer, Comparator& comp) {
+        if (n <= kRunSize) {
+            detail::insertionSort(arr, n, comp);
+            return;
+        }
+        const size_t mid = (n + 1) / 2;
+        sortHalfBuffer(arr, mid, buffer, comp);
+        sortHalfBuffer(arr + mid, n - mid, buffer, comp);
+        if (!comp(arr[mid], arr[mid - 1])) return;
+
+        // Only the left half moves out, into raw storage it is destroyed from again; the
+        // output never overtakes the unread right half
+        std::uninitialized_move(arr, arr + mid, buffer);
+        struct Release {
+            T* values;
+            size_t count;
+            ~Release() { std::destroy_n(values, count); }
+        } release{buffer, mid};
+        size_t i = 0, j = mid, k = 0;
+        while (i < mid && j < n) arr[k++] = comp(arr[j], buffer[i]) ? std::move(arr[j++]) : std::move(buffer[i++]);
+        while (i < mid) arr[k++] = std::move(buffer[i++]);
+    }
+
+    static void sortInPlace(T* arr, size_t n, Comparator& comp) {
+        sortRuns(arr, n, comp);
+        for (size_t width = kRunSize; width < n; width *= 2) {
+            for (size_t low = 0; low + width < n; low += 2 * width) {
+                mergeInPlace(arr + low, arr + low + width, arr + std::min(n, low + 2 * width), comp);
+            }
+        }
+    }
+
+    /**
+     * @brief Stable merge of [first, middle) and [middle, last) by recursive rotations
+     */
+    static void mergeInPlace(T* first, T* middle, T* last, Comparator& comp) {
+        const size_t len1 = static_cast<size_t>(middle - first);
+        const size_t len2 = static_cast<size_t>(last - middle);
+        if (len1 == 0 || len2 == 0) return;
+        if (len1 + len2 == 2) {
+            if (comp(*middle, *first)) std::iter_swap(first, middle);
+            return;
+        }
+        T* cut1;
+        T* cut2;
+        if (len1 > len2) {
+            cut1 = first + len1 / 2;
+            cut2 = std::lower_bound(middle, last, *cut1, comp);
+        } else {
+            cut2 = middle + len2 / 2;
+            cut1 = std::upper_bound(first, middle, *cut2, comp);
+        }
+        T* newMiddle = std::rotate(cut1, middle, cut2);
+        mergeInPlace(first, cut1, newMiddle, comp);
+        mergeInPlace(newMiddle, cut2, last, comp);
+    }
+
+    /**
+     * @brief Sorts through ExternalSort with the limit as its budget; returns its peak bytes
+     */
+    static size_t spill(std::vector<T>& arr, const MergeSortOptions& options, Comparator& comp) {
+        if constexpr (std::is_integral<T>::value) {
+            struct ArraySource {
+                const T* pos;
+                const T* end;
+                bool next(T& value) {
+                    if (pos == end) return false;
+                    value = *pos++;
+                    return true;
+                }
+            };
+            struct ArraySink {
+                T* pos;
+                void write(const T& value) { *pos++ = value; }
+            };
+
+            ExternalSortOptions external;
+            external.memoryBudget = options.memoryLimit;
+            external.tempDirectory = options.spillDirectory;
+            ExternalSort<T, Comparator> sorter(external, comp);
+            ArraySource source{arr.data(), arr.data() + arr.size()};
+            ArraySink sink{arr.data()};
+            sorter.sort(source, sink);
+            return static_cast<size_t>(sorter.stats().peakMemoryBytes);
+        } else {
+            sortInPlace(arr.data(), arr.size(), comp);
+            return 0;
+        }
+    }
+};
+
+template<typename T, typename Comparator = std::less<T>>
+MergeSortReport mergeSort(std::vector<T>& arr, const MergeSortOptions& options, Comparator comp = Comparator()) {
+    return BoundedMergeSort<T, Comparator>::sort(arr, options, comp);
+}
+
+struct SortCacheOptions {
+    size_t memoryBytes = size_t(64) << 20;  ///< budget for results held in memory
+    size_t diskBytes = 0;                   ///< budget for results kept in files; 0 disables the disk tier
+    size_t diskThreshold = size_t(1) << 20; ///< results at least this large go to disk when it is enabled
+    std::string directory;                  ///< disk tier location; empty: the system temporary directory
+};
+
+struct SortCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t memoryBytes = 0;  ///< bytes of inputs and results currently held in memory
+    uint64_t diskBytes = 0;    ///< bytes of inputs and results currently held on disk
+
+    double hitRate() const { return hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0; }
+};
+
+/**
+ * @class SortCache
+ * @brief Remembers sorted results so that sorting the same batch again is a copy
+ *
+ * Entries are keyed by a 128-bit hash of the input bytes, its length and the comparator
+ * type, so only stateless comparators should share a cache. Each entry also keeps the
+ * input it was sorted from, and a hit is confirmed by comparing input bytes: a hash
+ * collision replaces the entry instead of returning another input's result. Small
+ * entries are kept in memory and, when a disk budget is set, large ones in files; each
+ * tier evicts its least recently used entries to stay within its budget, and entries
+ * larger than a whole tier are not cached. An entry takes twice the bytes of its result.
+ */
+template<typename T>
+class SortCache {
+    static_assert(std::is_trivially_copyable<T>::value, "SortCache hashes and stores values as raw bytes");
+
+public:
+    explicit SortCache(SortCacheOptions options = SortCacheOptions()) : options_(std::move(options)) {
+        if (options_.diskBytes > 0 && options_.directory.empty()) {
+            options_.directory = std::filesystem::temp_directory_path().string();
+        }
+    }
+
+    SortCache(const SortCache&) = delete;
+    SortCache& operator=(const SortCache&) = delete;
+
+    ~SortCache() { clear(); }
+
+    /**
+     * @brief Sorts values in place, from the cache when this input was sorted before
+     * @return true on a cache hit
+     */
+    template<typename Comparator = std::less<T>>
+    bool sort(std::vector<T>& values, Comparator comp = Comparator()) {
+        const Key key = makeKey(values, typeid(Comparator));
+        auto found = index_.find(key);
+        if (found != index_.end()) {
+            if (load(*found->second, values)) {
+                entries_.splice(entries_.begin(), entries_, found->second);
+                ++stats_.hits;
+                return true;
+            }
+            remove(found->second);
+        }
+        ++stats_.misses;
+        const std::vector<T> input = values;
+        mergeSort(values, comp);
+        store(key, input, values);
+        return false;
+    }
+
+    void clear() {
+        for (Entry& entry : entries_) dropFile(entry);
+        entries_.clear();
+        index_.clear();
+        stats_.memoryBytes = stats_.diskBytes = 0;
+    }
+
+    size_t size() const { return entries_.size(); }
+    const SortCacheStats& stats() const { return stats_; }
+
+private:
+    struct Key {
+        uint64_t low;
+        uint64_t high;
+        uint64_t length;
+        size_t comparator;
+
+        bool operator==(const Key& other) const {
+            return low == other.low && high == other.high && length == other.length && comparator == other.comparator;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return static_cast<size_t>(key.low ^ key.comparator); }
+    };
+
+    struct Entry {
+        Key key;
+        size_t bytes = 0;       ///< input and result
+        std::vector<T> input;   ///< memory tier
+        std::vector<T> values;  ///< memory tier
+        std::string path;       ///< disk tier: the input followed by the result
+    };
+
+    /**
+     * @brief Two independent multiply-rotate lanes over the input bytes, 8 at a time
+     */
+    static Key makeKey(const std::vector<T>& values, const std::type_info& comparator) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values.data());
+        const size_t size = values.size() * sizeof(T);
+        uint64_t low = 0x9E3779B97F4A7C15ull ^ size;
+        uint64_t high = 0xC2B2AE3D27D4EB4Full + size;
+        auto mix = [&](uint64_t word) {
+            low = rotateLeft((low ^ word) * 0xFF51AFD7ED558CCDull, 31);
+            high = rotateLeft((high + word) * 0xC4CEB9FE1A85EC53ull, 29) ^ low;
+        };
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            mix(word);
+        }
+        if (i < size) mix(detail::loadLE(bytes + i, size - i) ^ (uint64_t(size - i) << 56));
+        mix(low ^ high);
+        return Key{low, high, static_cast<uint64_t>(values.size()), comparator.hash_code()};
+    }
+
+    static uint64_t rotateLeft(uint64_t v, unsigned bits) { return (v << bits) | (v >> (64 - bits)); }
+
+    bool onDisk(size_t bytes) const { return options_.diskBytes > 0 && bytes >= options_.diskThreshold; }
+
+    void store(const Key& key, const std::vector<T>& input, const std::vector<T>& values) {
+        Entry entry;
+        entry.key = key;
+        entry.bytes = 2 * values.size() * sizeof(T);
+        if (onDisk(values.size() * sizeof(T))) {
+            if (entry.bytes > options_.diskBytes) return;
+            evict(true, entry.bytes);
+            entry.path = newPath();
+            io::FileHandle file = io::openFile(entry.path, "wb");
+            if (std::fwrite(input.data(), sizeof(T), input.size(), file.get()) != input.size() ||
+                std::fwrite(values.data(), sizeof(T), values.size(), file.get()) != values.size() ||
+                std::fflush(file.get()) != 0) {
+                file.reset();
+                std::remove(entry.path.c_str());
+                throw std::runtime_error("Cannot write sort cache file '" + entry.path + "'");
+            }
+            stats_.diskBytes += entry.bytes;
+        } else {
+            if (entry.bytes > options_.memoryBytes) return;
+            evict(false, entry.bytes);
+            entry.input = input;
+            entry.values = values;
+            stats_.memoryBytes += entry.bytes;
+        }
+        entries_.push_front(std::move(entry));
+        index_[key] = entries_.begin();
+    }
+
+    /**
+     * @brief Replaces values with the entry's result if the entry was sorted from exactly
+     * these values; leaves them untouched and returns false otherwise
+     */
+    bool load(const Entry& entry, std::vector<T>& values) const {
+        if (entry.path.empty()) {
+            if (entry.input.size() != values.size() ||
+                std::memcmp(entry.input.data(), values.data(), values.size() * sizeof(T)) != 0) {
+                return false;
+            }
+            values = entry.values;
+            return true;
+        }
+        io::FileHandle file = io::openFile(entry.path, "rb");
+        std::vector<T> block(std::min<size_t>(values.size(), std::max<size_t>(1, (size_t(64) << 10) / sizeof(T))));
+        for (size_t done = 0; done < values.size();) {
+            const size_t count = std::min(block.size(), values.size() - done);
+            if (std::fread(block.data(), sizeof(T), count, file.get()) != count) {
+                throw std::runtime_error("Sort cache file '" + entry.path + "' is truncated");
+            }
+            if (std::memcmp(block.data(), values.data() + done, count * sizeof(T)) != 0) return false;
+            done += count;
+        }
+        if (std::fread(values.data(), sizeof(T), values.size(), file.get()) != values.size()) {
+            throw std::runtime_error("Sort cache file '" + entry.path + "' is truncated");
+        }
+        return true;
+    }
+
+    /**
+     * @brief Evicts least recently used entries of one tier until `incoming` more bytes fit
+     */
+    void evict(bool disk, size_t incoming) {
+        const uint64_t budget = disk ? options_.diskBytes : options_.memoryBytes;
+        uint64_t& used = disk ? stats_.diskBytes : stats_.memoryBytes;
+        for (auto it = entries_.end(); used + incoming > budget && it != entries_.begin();) {
+            --it;
+            if (it->path.empty() == disk) continue;
+            it = remove(it);
+            ++stats_.evictions;
+        }
+    }
+
+    typename std::list<Entry>::iterator remove(typename std::list<Entry>::iterator it) {
+        (it->path.empty() ? stats_.memoryBytes : stats_.diskBytes) -= it->bytes;
+        dropFile(*it);
+        index_.erase(it->key);
+        return entries_.erase(it);
+    }
+
+    static void dropFile(const Entry& entry) {
+        if (!entry.path.empty()) std::remove(entry.path.c_str());
+    }
+
+    std::string newPath() {
+#ifdef SORTING_POSIX
+        const long pid = static_cast<long>(::getpid());
+#else
+        const long pid = 0;
+#endif
+        const std::string name = "sortcache-" + std::to_string(pid) + "-" + std::to_string(reinterpret_cast<uintptr_t>(this)) +
+                                 "-" + std::to_string(nextFile_++) + ".bin";
+        return (std::filesystem::path(options_.directory) / name).string();
+    }
+
+    SortCacheOptions options_;
+    std::list<Entry> entries_;  ///< most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash> index_;
+    SortCacheStats stats_;
+    uint64_t nextFile_ = 0;
+};
+
+/**
+ * @class StreamingTopK
+ * @brief Keeps the k greatest values of an unbounded stream in O(k) memory
+ *
+ * Values collect in a buffer of 2k; when it fills, nth_element keeps the best k and the
+ * k-th best becomes a threshold that rejects most later values with one comparison. A
+ * selection costs O(k) and happens at most once per k accepted values, so each value
+ * costs O(1) amortized. "Greatest" follows the comparator: std::greater keeps the least.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class StreamingTopK {
+public:
+    explicit StreamingTopK(size_t k, Comparator comp = Comparator()) : k_(k), comp_(comp) {
+        if (k_ == 0) throw std::invalid_argument("StreamingTopK needs k of at least 1");
+        buffer_.reserve(2 * k_);
+    }
+
+    void push(const T& value) {
+        ++seen_;
+        if (hasThreshold_ && !comp_(threshold_, value)) return;
+        buffer_.push_back(value);
+        if (buffer_.size() == 2 * k_) compact();
+    }
+
+    /**
+     * @brief The current top k (fewer if fewer values were seen), best first
+     */
+    std::vector<T> top() const {
+        std::vector<T> result(buffer_);
+        auto better = [this](const T& a, const T& b) { return comp_(b, a); };
+        if (result.size() > k_) {
+            std::nth_element(result.begin(), result.begin() + (k_ - 1), result.end(), better);
+            result.resize(k_);
+        }
+        std::sort(result.begin(), result.end(), better);
+        return result;
+    }
+
+    uint64_t seen() const { return seen_; }
+    size_t k() const { return k_; }
+
+private:
+    void compact() {
+        auto better = [this](const T& a, const T& b) { return comp_(b, a); };
+        std::nth_element(buffer_.begin(), buffer_.begin() + (k_ - 1), buffer_.end(), better);
+        buffer_.resize(k_);
+        threshold_ = buffer_[k_ - 1];
+        hasThreshold_ = true;
+    }
+
+    const size_t k_;
+    Comparator comp_;
+    std::vector<T> buffer_;
+    T threshold_ = T();
+    bool hasThreshold_ = false;
+    uint64_t seen_ = 0;
+};
+
+/**
+ * @class SortedWindow
+ * @brief Sliding window of the last `capacity` values with O(log w) order statistics
+ *
+ * Values are kept in an order-statistic treap (a randomized BST whose nodes also store
+ * their subtree size) next to a FIFO of arrival order. push() inserts a value and evicts
+ * the oldest once the window is full; select(), rank(), median() and quantile() walk one
+ * root-to-leaf path. Nodes live in one vector and are recycled through a free list, so a
+ * full window allocates nothing.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class SortedWindow {
+public:
+    explicit SortedWindow(size_t capacity, Comparator comp = Comparator()) : capacity_(capacity), comp_(comp) {
+        if (capacity_ == 0) throw std::invalid_argument("SortedWindow capacity must be positive");
+        nodes_.reserve(capacity_ + 1);
+        nodes_.emplace_back();  // node 0 is the empty tree
+    }
+
+    /**
+     * @brief Adds value, evicting the oldest value first when the window is full
+     */
+    void push(const T& value) {
+        if (arrivals_.size() == capacity_) evictOldest();
+        insert(value);
+        arrivals_.push_back(value);
+    }
+
+    void evictOldest() {
+        if (arrivals_.empty()) throw std::out_of_range("SortedWindow is empty");
+        erase(arrivals_.front());
+        arrivals_.pop_front();
+    }
+
+    size_t size() const { return nodes_[root_].size; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return root_ == 0; }
+
+    /**
+     * @brief The k-th smallest value, counting from 0
+     */
+    const T& select(size_t k) const {
+        if (k >= size()) throw std::out_of_range("SortedWindow::select index out of range");
+        uint32_t node = root_;
+        for (;;) {
+            const size_t leftSize = nodes_[nodes_[node].left].size;
+            if (k < leftSize) {
+                node = nodes_[node].left;
+            } else if (k == leftSize) {
+                return nodes_[node].value;
+            } else {
+                k -= leftSize + 1;
+                node = nodes_[node].right;
+            }
+        }
+    }
+
+    /**
+     * @brief Number of values in the window that sort before value
+     */
+    size_t rank(const T& value) const {
+        size_t below = 0;
+        for (uint32_t node = root_; node != 0;) {
+            if (comp_(nodes_[node].value, value)) {
+                below += nodes_[nodes_[node].left].size + 1;
+                node = nodes_[node].right;
+            } else {
+                node = nodes_[node].left;
+            }
+        }
+        return below;
+    }
+
+    /**
+     * @brief Lower median (the middle value, or the smaller of the two middle values)
+     */
+    const T& median() const { return select((size() - 1) / 2); }
+
+    /**
+     * @brief Nearest-rank quantile, q in [0, 1]
+     */
+    const T& quantile(double q) const {
+        if (empty()) throw std::out_of_range("SortedWindow is empty");
+        q = std::min(1.0, std::max(0.0, q));
+        return select(std::min(size() - 1, static_cast<size_t>(q * static_cast<double>(size() - 1) + 0.5)));
+    }
+
+private:
+    struct Node {
+        T value = T();
+        uint32_t priority = 0;
+        uint32_t left = 0;
+        uint32_t right = 0;
+        uint32_t size = 0;
+    };
+
+    void insert(const T& value) {
+        uint32_t fresh;
+        if (!free_.empty()) {
+            fresh = free_.back();
+            free_.pop_back();
+        } else {
+            fresh = static_cast<uint32_t>(nodes_.size());
+            nodes_.emplace_back();
+        }
+        Node& node = nodes_[fresh];
+        node.value = value;
+        node.priority = nextPriority();
+        node.left = node.right = 0;
+        node.size = 1;
+
+        uint32_t less, rest;
+        split(root_, value, less, rest);
+        root_ = merge(merge(less, fresh), rest);
+    }
+
+    /**
+     * @brief Removes one value equivalent to value; false if there is none
+     */
+    bool erase(const T& value) {
+        uint32_t less, rest, first, greater;
+        split(root_, value, less, rest);
+        splitFirst(rest, first, greater);
+        if (first == 0 || comp_(value, nodes_[first].value)) {
+            root_ = merge(less, merge(first, greater));
+            return false;
+        }
+        free_.push_back(first);
+        root_ = merge(less, greater);
+        return true;
+    }
+
+    /**
+     * @brief Splits tree into values before value (less) and the rest
+     */
+    void split(uint32_t tree, const T& value, uint32_t& less, uint32_t& rest) {
+        if (tree == 0) {
+            less = rest = 0;
+            return;
+        }
+        Node& node = nodes_[tree];
+        if (comp_(node.value, value)) {
+            split(node.right, value, nodes_[tree].right, rest);
+            less = tree;
+        } else {
+            split(node.left, value, less, nodes_[tree].left);
+            rest = tree;
+        }
+        update(tree);
+    }
+
+    /**
+     * @brief Detaches the smallest node of tree
+     */
+    void splitFirst(uint32_t tree, uint32_t& first, uint32_t& rest) {
+        if (tree == 0) {
+            first = rest = 0;
+            return;
+        }
+        if (nodes_[tree].left == 0) {
+            first = tree;
+            rest = nodes_[tree].right;
+            nodes_[tree].right = 0;
+            update(tree);
+            return;
+        }
+        splitFirst(nodes_[tree].left, first, nodes_[tree].left);
+        rest = tree;
+        update(tree);
+    }
+
+    uint32_t merge(uint32_t left, uint32_t right) {
+        if (left == 0 || right == 0) return left ? left : right;
+        if (nodes_[left].priority > nodes_[right].priority) {
+            nodes_[left].right = merge(nodes_[left].right, right);
+            update(left);
+            return left;
+        }
+        nodes_[right].left = merge(left, nodes_[right].left);
+        update(right);
+        return right;
+    }
+
+    void update(uint32_t tree) {
+        Node& node = nodes_[tree];
+        node.size = nodes_[node.left].size + nodes_[node.right].size + 1;
+    }
+
+    uint32_t nextPriority() {
+        // xorshift32: cheap and good enough to keep the expected depth logarithmic
+        seed_ ^= seed_ << 13;
+        seed_ ^= seed_ >> 17;
+        seed_ ^= seed_ << 5;
+        return seed_;
+    }
+
+    const size_t capacity_;
+    Comparator comp_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> free_;
+    std::deque<T> arrivals_;
+    uint32_t root_ = 0;
+    uint32_t seed_ = 0x9E3779B9u;
+};
+
+/**
+ * @class KllSketch
+ * @brief Mergeable approximate quantile sketch (Karnin, Lang and Liberty)
+ *
+ * Level h holds values that each stand for 2^h inputs. When the sketch outgrows its
+ * capacity, the lowest full level is sorted and every other value (from a random offset)
+ * is promoted, halving that level. Capacities shrink geometrically by 2/3 towards the
+ * lower levels, so about 3k values are retained however long the stream is, and a rank
+ * estimate is within normalizedRankError() of the truth with high probability.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class KllSketch {
+public:
+    explicit KllSketch(size_t k = 200, Comparator comp = Comparator(), uint64_t seed = 0x2545F4914F6CDD1Dull)
+        : k_(k), comp_(comp), random_(seed ? seed : 1) {
+        if (k_ < 8) throw std::invalid_argument("KllSketch needs k of at least 8");
+        levels_.emplace_back();
+    }
+
+    /**
+     * @brief Smallest k whose rank error (about 2.3 / k^0.97, two-sided) is at most epsilon
+     */
+    static size_t kForError(double epsilon) {
+        if (!(epsilon > 0)) throw std::invalid_argument("KllSketch error bound must be positive");
+        return std::max<size_t>(8, static_cast<size_t>(std::ceil(std::pow(2.296 / epsilon, 1.0 / 0.9723))));
+    }
+
+    /**
+     * @brief Largest k whose retained values fit in about `bytes` of memory
+     */
+    static size_t kForMemory(size_t bytes) { return std::max<size_t>(8, bytes / (3 * sizeof(T))); }
+
+    double normalizedRankError() const { return 2.296 / std::pow(static_cast<double>(k_), 0.9723); }
+
+    void update(const T& value) {
+        levels_[0].push_back(value);
+        ++count_;
+        if (++retained_ > capacityTotal()) compress();
+    }
+
+    /**
+     * @brief Folds another sketch (same k and comparator) into this one
+     */
+    void merge(const KllSketch& other) {
+        if (other.k_ != k_) throw std::invalid_argument("Cannot merge KllSketches with different k");
+        while (levels_.size() < other.levels_.size()) levels_.emplace_back();
+        for (size_t h = 0; h < other.levels_.size(); ++h) {
+            levels_[h].insert(levels_[h].end(), other.levels_[h].begin(), other.levels_[h].end());
+        }
+        count_ += other.count_;
+        retained_ += other.retained_;
+        while (retained_ > capacityTotal()) compress();
+    }
+
+    /**
+     * @brief Approximate q-quantile, q in [0, 1]
+     */
+    T quantile(double q) const {
+        if (count_ == 0) throw std::out_of_range("KllSketch is empty");
+        const std::vector<std::pair<T, uint64_t>> items = weightedItems();
+        const double target = std::min(1.0, std::max(0.0, q)) * static_cast<double>(count_);
+        uint64_t cumulative = 0;
+        for (const auto& item : items) {
+            cumulative += item.second;
+            if (static_cast<double>(cumulative) >= target) return item.first;
+        }
+        return items.back().first;
+    }
+
+    /**
+     * @brief Approximate fraction of inputs that sort before value
+     */
+    double rank(const T& value) const {
+        if (count_ == 0) return 0.0;
+        uint64_t below = 0;
+        for (size_t h = 0; h < levels_.size(); ++h) {
+            for (const T& v : levels_[h]) {
+                if (comp_(v, value)) below += uint64_t(1) << h;
+            }
+        }
+        return static_cast<double>(below) / static_cast<double>(count_);
+    }
+
+    uint64_t count() const { return count_; }
+    size_t retained() const { return retained_; }
+    size_t k() const { return k_; }
+
+    size_t memoryBytes() const {
+        size_t bytes = sizeof(*this) + levels_.capacity() * sizeof(std::vector<T>);
+        for (const auto& level : levels_) bytes += level.capacity() * sizeof(T);
+        return bytes;
+    }
+
+private:
+    size_t capacity(size_t h) const {
+        const size_t depth = levels_.size() - 1 - h;
+        return std::max<size_t>(2, static_cast<size_t>(std::ceil(static_cast<double>(k_) * std::pow(2.0 / 3.0, depth))));
+    }
+
+    size_t capacityTotal() const {
+        size_t total = 0;
+        for (size_t h = 0; h < levels_.size(); ++h) total += capacity(h);
+        return total;
+    }
+
+    /**
+     * @brief Compacts the lowest full level into the one above it
+     */
+    void compress() {
+        for (size_t h = 0; h < levels_.size(); ++h) {
+            if (levels_[h].size() < capacity(h)) continue;
+            if (h + 1 == levels_.size()) levels_.emplace_back();
+            std::vector<T>& level = levels_[h];
+            mergeSort(level, comp_);
+
+            // An odd value out stays behind so that promoted pairs keep the weights exact
+            T leftover = T();
+            const bool odd = level.size() % 2 == 1;
+            if (odd) {
+                leftover = level.back();
+                level.pop_back();
+            }
+            std::vector<T>& above = levels_[h + 1];
+            for (size_t i = nextBit(); i < level.size(); i += 2) above.push_back(level[i]);
+            retained_ -= level.size() / 2;
+            level.clear();
+            // Capacities shrink as levels are added; release what this level no longer needs
+            if (level.capacity() > 2 * capacity(h)) std::vector<T>().swap(level);
+            if (odd) level.push_back(leftover);
+            return;
+        }
+    }
+
+    std::vector<std::pair<T, uint64_t>> weightedItems() const {
+        std::vector<std::pair<T, uint64_t>> items;
+        items.reserve(retained_);
+        for (size_t h = 0; h < levels_.size(); ++h) {
+            for (const T& v : levels_[h]) items.emplace_back(v, uint64_t(1) << h);
+        }
+        auto byValue = [this](const std::pair<T, uint64_t>& a, const std::pair<T, uint64_t>& b) {
+            return comp_(a.first, b.first);
+        };
+        mergeSort(items, byValue);
+        return items;
+    }
+
+    size_t nextBit() {
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 7;
+        random_ ^= random_ << 17;
+        return static_cast<size_t>(random_ & 1);
+    }
+
+    const size_t k_;
+    Comparator comp_;
+    std::vector<std::vector<T>> levels_;  ///< levels_[h] values weigh 2^h
+    uint64_t count_ = 0;
+    size_t retained_ = 0;
+    uint64_t random_;
+};
+
+namespace detail {
+
+/**
+ * @brief lower_bound that probes first[1], first[3], first[7], ... before a binary search
+ *
+ * Costs O(log d) comparisons where d is the distance to the answer, so walking a long
+ * sorted range in short hops stays cheap.
+ */
+template<typename It, typename V, typename Comparator>
+It gallopLowerBound(It first, It last, const V& value, Comparator& comp) {
+    const size_t size = static_cast<size_t>(last - first);
+    if (size == 0 || !comp(*first, value)) return first;
+    size_t bound = 1;
+    while (bound < size && comp(first[bound], value)) bound = 2 * bound + 1;
+    return std::lower_bound(first + (bound - 1) / 2 + 1, first + std::min(bound, size), value, comp);
+}
+
+// Length ratio above which skipping through the longer input beats scanning it
+constexpr size_t kGallopRatio = 64;
+// Length ratio below which the branch-free intersection scan beats a predictable branchy one
+constexpr size_t kBranchFreeRatio = 4;
+
+/**
+ * @brief One pass over sorted a and b reporting runs only in a, runs only in b and equal pairs
+ *
+ * When one side is more than kGallopRatio times longer, its runs are skipped with
+ * gallopLowerBound while the short side is stepped, so the pass costs O(m log(n / m))
+ * comparisons instead of O(n + m).
+ */
+template<typename A, typename B, typename Comparator, typename OnlyA, typename OnlyB, typename Both>
+void sortedWalk(const std::vector<A>& a, const std::vector<B>& b, Comparator& comp,
+                OnlyA onlyA, OnlyB onlyB, Both both) {
+    const size_t n = a.size(), m = b.size();
+    const bool gallopA = n > kGallopRatio * m;
+    const bool gallopB = m > kGallopRatio * n;
+    size_t i = 0, j = 0;
+    while (i < n && j < m) {
+        if (comp(a[i], b[j])) {
+            const size_t end = gallopA ? static_cast<size_t>(gallopLowerBound(a.begin() + i, a.end(), b[j], comp) - a.begin())
+                                       : i + 1;
+            onlyA(i, end);
+            i = end;
+        } else if (comp(b[j], a[i])) {
+            const size_t end = gallopB ? static_cast<size_t>(gallopLowerBound(b.begin() + j, b.end(), a[i], comp) - b.begin())
+                                       : j + 1;
+            onlyB(j, end);
+            j = end;
+        } else {
+            both(i++, j++);
+        }
+    }
+    if (i < n) onlyA(i, n);
+    if (j < m) onlyB(j, m);
+}
+
+} // namespace detail
+
+/**
+ * @brief Values present in both sorted inputs, with std::set_intersection multiset semantics
+ *
+ * Inputs of similar length are scanned without data-dependent branches: every step
+ * stores a candidate and advances the output only when the two heads are equal. With
+ * skewed lengths the branches become predictable, and beyond kGallopRatio the longer
+ * input is galloped through.
+ */
+template<typename T, typename Comparator = std::less<T>>
+std::vector<T> sortedIntersection(const std::vector<T>& a, const std::vector<T>& b, Comparator comp = Comparator()) {
+    std::vector<T> out;
+    const size_t n = a.size(), m = b.size();
+    if (n > detail::kGallopRatio * m || m > detail::kGallopRatio * n) {
+        out.reserve(std::min(n, m));
+        detail::sortedWalk(a, b, comp, [](size_t, size_t) {}, [](size_t, size_t) {},
+                           [&](size_t i, size_t) { out.push_back(a[i]); });
+        return out;
+    }
+    if (n > detail::kBranchFreeRatio * m || m > detail::kBranchFreeRatio * n) {
+        out.reserve(std::min(n, m));
+        std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out), comp);
+        return out;
+    }
+    out.resize(std::min(n, m) + 1);
+    size_t i = 0, j = 0, k = 0;
+    while (i < n && j < m) {
+        const bool aFirst = comp(a[i], b[j]);
+        const bool bFirst = comp(b[j], a[i]);
+        out[k] = a[i];
+        k += !(aFirst | bFirst);
+        i += !bFirst;
+        j += !aFirst;
+    }
+    out.resize(k);
+    return out;
+}
+
+/**
+ * @brief Values present in either sorted input, with std::set_union multiset semantics
+ */
+template<typename T, typename Comparator = std::less<T>>
+std::vector<T> sortedUnion(const std::vector<T>& a, const std::vector<T>& b, Comparator comp = Comparator()) {
+    std::vector<T> out;
+    out.reserve(a.size() + b.size());
+    detail::sortedWalk(a, b, comp,
+                       [&](size_t first, size_t last) { out.insert(out.end(), a.begin() + first, a.begin() + last); },
+                       [&](size_t first, size_t last) { out.insert(out.end(), b.begin() + first, b.begin() + last); },
+                       [&](size_t i, size_t) { out.push_back(a[i]); });
+    return out;
+}
+
+/**
+ * @brief Values of sorted a that are not in sorted b, with std::set_difference multiset semantics
+ */
+template<typename T, typename Comparator = std::less<T>>
+std::vector<T> sortedDifference(const std::vector<T>& a, const std::vector<T>& b, Comparator comp = Comparator()) {
+    std::vector<T> out;
+    out.reserve(a.size());
+    detail::sortedWalk(a, b, comp,
+                       [&](size_t first, size_t last) { out.insert(out.end(), a.begin() + first, a.begin() + last); },
+                       [](size_t, size_t) {}, [](size_t, size_t) {});
+    return out;
+}
+
+/**
+ * @brief Calls fn(l, r) for every pair of equal-keyed elements of two sorted inputs
+ *
+ * comp must order a left element against a right one in both argument orders (as for
+ * std::set_intersection), e.g. a transparent comparator over a key field. Groups of
+ * duplicate keys produce their full cross product, as in a relational equi-join.
+ */
+template<typename L, typename R, typename Fn, typename Comparator = std::less<>>
+void mergeJoin(const std::vector<L>& left, const std::vector<R>& right, Fn fn, Comparator comp = Comparator()) {
+    size_t lastLeft = 0;
+    size_t lastRight = 0;
+    detail::sortedWalk(left, right, comp, [](size_t, size_t) {}, [](size_t, size_t) {}, [&](size_t i, size_t j) {
+        // The walk pairs equal elements one to one; expand each new key group once
+        if (i < lastLeft || j < lastRight) return;
+        size_t leftEnd = i + 1, rightEnd = j + 1;
+        while (leftEnd < left.size() && !comp(right[j], left[leftEnd])) ++leftEnd;
+        while (rightEnd < right.size() && !comp(left[i], right[rightEnd])) ++rightEnd;
+        for (size_t x = i; x < leftEnd; ++x) {
+            for (size_t y = j; y < rightEnd; ++y) fn(left[x], right[y]);
+        }
+        lastLeft = leftEnd;
+        lastRight = rightEnd;
+    });
+}
+
+namespace detail {
+
+inline void prefetchRead(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+}
+
+/**
+ * @brief Strips the trailing one bits of an Eytzinger descent, and the zero bit above them
+ *
+ * A descent appends a 1 bit for every step right; the lower bound is where the last left
+ * step happened, so everything from the lowest zero bit down is removed.
+ */
+inline size_t eytzingerAncestor(size_t k) {
+#if defined(__GNUC__) || defined(__clang__)
+    return k >> (__builtin_ctzll(~static_cast<unsigned long long>(k)) + 1);
+#else
+    while (k & 1) k >>= 1;
+    return k >> 1;
+#endif
+}
+
+} // namespace detail
+
+/**
+ * @class EytzingerIndex
+ * @brief Sorted values stored in BFS (Eytzinger) order for cache-friendly lower bounds
+ *
+ * Node k has children 2k and 2k + 1, so the first levels of the tree share a few cache
+ * lines and each deeper level is one predictable address away. The search loop has no
+ * data-dependent branches and prefetches the cache line holding the node's descendants
+ * several levels down while the current comparison is in flight. The batched lowerBound
+ * advances a group of queries one level at a time, so their cache misses overlap.
+ */
+template<typename T, typename Comparator = std::less<T>>
+class EytzingerIndex {
+public:
+    /**
+     * @brief Builds the layout from values already sorted by comp
+     */
+    explicit EytzingerIndex(const std::vector<T>& sorted, Comparator comp = Comparator())
+        : comp_(comp), tree_(sorted.size() + 1), ranks_(sorted.size() + 1) {
+        if (sorted.size() >= std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error("EytzingerIndex holds fewer than 2^32 values");
+        }
+        build(sorted, 0, 1);
+        ranks_[0] = static_cast<uint32_t>(sorted.size());
+        for (size_t h = 1; h <= sorted.size(); h *= 2) ++height_;
+    }
+
+    size_t size() const { return tree_.size() - 1; }
+
+    /**
+     * @brief Sorted position of the first value not before key (size() if there is none)
+     */
+    size_t lowerBound(const T& key) const {
+        const size_t n = size();
+        const T* tree = tree_.data();
+        size_t k = 1;
+        while (k <= n) {
+            detail::prefetchRead(tree + std::min(k * kPrefetchStride, n));
+            k = 2 * k + static_cast<size_t>(comp_(tree[k], key));
+        }
+        return ranks_[detail::eytzingerAncestor(k)];
+    }
+
+    /**
+     * @brief lowerBound for every key, written to out[i]; keys need not be sorted
+     */
+    void lowerBound(const T* keys, size_t count, size_t* out) const {
+        const size_t n = size();
+        const T* tree = tree_.data();
+        for (size_t base = 0; base < count; base += kBatch) {
+            const size_t group = std::min(kBatch, count - base);
+            size_t k[kBatch];
+            for (size_t q = 0; q < group; ++q) k[q] = 1;
+            for (size_t level = 0; level < height_; ++level) {
+                for (size_t q = 0; q < group; ++q) {
+                    // Queries that already left the tree keep their position; node 0 is a safe dummy read
+                    const size_t node = k[q] <= n ? k[q] : 0;
+                    detail::prefetchRead(tree + std::min(node * kPrefetchStride, n));
+                    const size_t next = 2 * node + static_cast<size_t>(comp_(tree[node], keys[base + q]));
+                    k[q] = node ? next : k[q];
+                }
+            }
+            for (size_t q = 0; q < group; ++q) out[base + q] = ranks_[detail::eytzingerAncestor(k[q])];
+        }
+    }
+
+    std::vector<size_t> lowerBound(const std::vector<T>& keys) const {
+        std::vector<size_t> out(keys.size());
+        lowerBound(keys.data(), keys.size(), out.data());
+        return out;
+    }
+
+private:
+    /**
+     * @brief In-order walk of the implicit tree from node k, which visits sorted[i..] in order
+     */
+    size_t build(const std::vector<T>& sorted, size_t i, size_t k) {
+        if (k >= tree_.size()) return i;
+        i = build(sorted, i, 2 * k);
+        tree_[k] = sorted[i];
+        ranks_[k] = static_cast<uint32_t>(i++);
+        return build(sorted, i, 2 * k + 1);
+    }
+
+    // Node k's descendants four levels down are 16k..16k+15, adjacent in memory
+    static constexpr size_t kPrefetchStride = 16;
+    static constexpr size_t kBatch = 16;
+
+    Comparator comp_;
+    std::vector<T> tree_;         ///< tree_[1..n] in Eytzinger order; tree_[0] is unused
+    std::vector<uint32_t> ranks_; ///< sorted position of each node; ranks_[0] = n ("not found")
+    size_t height_ = 0;
+};
+
+struct LearnedSortReport {
+    bool usedModel = false;    ///< false: the model looked poor on the sample and MergeSort sorted the input
+    size_t segments = 0;       ///< linear pieces in the fitted CDF
+    size_t buckets = 0;        ///< buckets the model scattered into
+    double overflowShare = 0;  ///< share of the validation sample that fell into overfull buckets
+};
+
+/**
+ * @class LearnedSort
+ * @brief Distribution sort that places numeric keys with a learned CDF model
+ *
+ * A piecewise-linear CDF is fitted to the quantiles of a random sample and predicts each
+ * key's relative position. Keys are scattered by that prediction in two rounds: coarse
+ * buckets that fit in cache, then fine buckets of about kBucketFill keys. The model is
+ * monotone, so keys can only be out of order within a fine bucket, and insertion sort
+ * fixes those. Before scattering, the model is scored on a second half of the sample. If
+ * too many keys crowd into overfull buckets of distinct keys, MergeSort sorts the input.
+ * Scratch memory is n keys plus two 32-bit bucket ids per key.
+ */
+template<typename T>
+class LearnedSort {
+    static_assert(std::is_arithmetic<T>::value, "LearnedSort keys must be arithmetic types");
+
+public:
+    static LearnedSortReport sort(std::vector<T>& arr) {
+        LearnedSortReport report;
+        if (arr.size() < kMinLearned) {
+            MergeSort<T>::sort(arr);
+            return report;
+        }
+        std::vector<T> train, validation;
+        drawSample(arr, train, validation);
+        const Model model(train);
+        report.segments = model.segments();
+        report.overflowShare = overflowShare(model, validation);
+        if (report.overflowShare > kMaxOverflowShare) {
+            MergeSort<T>::sort(arr);
+            return report;
+        }
+        report.usedModel = true;
+        report.buckets = scatter(arr, model);
+        return report;
+    }
+
+private:
+    /**
+     * @brief Monotone piecewise-linear CDF through evenly spaced quantiles of a sorted sample
+     *
+     * Repeated quantile values collapse into one knot where the CDF jumps, so a heavily
+     * duplicated key maps to one position instead of a flat run of buckets.
+     */
+    class Model {
+    public:
+        explicit Model(const std::vector<T>& sorted) {
+            const size_t last = sorted.size() - 1;
+            const size_t pieces = std::max<size_t>(1, std::min(kSegments, last));
+            for (size_t j = 0; j <= pieces; ++j) {
+                const double x = static_cast<double>(sorted[j * last / pieces]);
+                const double y = static_cast<double>(j) / pieces;
+                if (!xs_.empty() && !(xs_.back() < x)) {
+                    startY_.back() = y;  // same x as the previous knot: the CDF jumps here
+                    continue;
+                }
+                if (!xs_.empty()) slopes_.back() = (y - startY_.back()) / (x - xs_.back());
+                xs_.push_back(x);
+                startY_.push_back(y);
+                slopes_.push_back(0.0);
+            }
+        }
+
+        size_t segments() const { return xs_.size(); }
+
+        /**
+         * @brief Bucket in [0, buckets) for key; non-decreasing in key
+         */
+        size_t bucket(T key, size_t buckets) const {
+            const double x = static_cast<double>(key);
+            // Branchless search for the last knot not above x (knot 0 if x is below all of them)
+            const double* base = xs_.data();
+            for (size_t len = xs_.size(); len > 1; len -= len / 2) {
+                base += base[len / 2] <= x ? len / 2 : 0;
+            }
+            const size_t i = static_cast<size_t>(base - xs_.data());
+            const double position = (startY_[i] + (x - xs_[i]) * slopes_[i]) * static_cast<double>(buckets);
+            // max(0.0, NaN) is 0.0, so unordered keys land in bucket 0
+            return std::min(buckets - 1, static_cast<size_t>(std::max(0.0, position)));
+        }
+
+    private:
+        std::vector<double> xs_;      ///< knot positions, strictly increasing
+        std::vector<double> startY_;  ///< CDF just after each knot
+        std::vector<double> slopes_;  ///< CDF slope up to the next knot; 0 after the last
+    };
+
+    static void drawSample(const std::vector<T>& arr, std::vector<T>& train, std::vector<T>& validation) {
+        const size_t size = std::min(kMaxSample, std::max(kMinSample, arr.size() / kSampleDivisor));
+        std::mt19937_64 rng(arr.size());
+        std::uniform_int_distribution<size_t> pick(0, arr.size() - 1);
+        train.reserve(size / 2);
+        validation.reserve(size / 2);
+        for (size_t i = 0; i < size; ++i) (i % 2 ? validation : train).push_back(arr[pick(rng)]);
+        MergeSort<T>::sort(train);
+        MergeSort<T>::sort(validation);
+    }
+
+    /**
+     * @brief Share of the sorted validation sample landing in buckets holding more than
+     * kOverflowFactor times their expected fill. Buckets of one repeated key are not
+     * counted, because they need no fix-up.
+     */
+    static double overflowShare(const Model& model, const std::vector<T>& sorted) {
+        const size_t buckets = std::max<size_t>(1, sorted.size() / kBucketFill);
+        size_t overflow = 0;
+        for (size_t begin = 0; begin < sorted.size();) {
+            const size_t id = model.bucket(sorted[begin], buckets);
+            size_t end = begin + 1;
+            while (end < sorted.size() && model.bucket(sorted[end], buckets) == id) ++end;
+            if (end - begin > kOverflowFactor * kBucketFill && sorted[begin] < sorted[end - 1]) overflow += end - begin;
+            begin = end;
+        }
+        return static_cast<double>(overflow) / static_cast<double>(sorted.size());
+    }
+
+    /**
+     * @brief Places arr by the model's buckets and fixes up each bucket; returns the bucket count
+     */
+    static size_t scatter(std::vector<T>& arr, const Model& model) {
+        const size_t n = arr.size();
+        size_t totalBits = 0;
+        while (totalBits < 31 && (size_t(2) << totalBits) * kBucketFill <= n) ++totalBits;
+        const size_t coarseBits = std::min(totalBits, kCoarseBits);
+        const size_t fineBits = totalBits - coarseBits;
+        const size_t buckets = size_t(1) << totalBits;
+
+        // Round 1: coarse buckets, carrying the computed bucket id along with each key
+        std::vector<uint32_t> ids(n);
+        std::vector<size_t> offsets((size_t(1) << coarseBits) + 1, 0);
+        for (size_t i = 0; i < n; ++i) {
+            ids[i] = static_cast<uint32_t>(model.bucket(arr[i], buckets));
+            ++offsets[(ids[i] >> fineBits) + 1];
+        }
+        for (size_t c = 1; c < offsets.size(); ++c) offsets[c] += offsets[c - 1];
+        std::unique_ptr<T[]> keys(new T[n]);
+        std::vector<uint32_t> keyIds(n);
+        {
+            std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < n; ++i) {
+                const size_t slot = next[ids[i] >> fineBits]++;
+                keys[slot] = arr[i];
+                keyIds[slot] = ids[i];
+            }
+        }
+        std::vector<uint32_t>().swap(ids);
+
+        // Round 2: fine buckets within each cache-sized coarse bucket, back into arr
+        const uint32_t fineMask = static_cast<uint32_t>((size_t(1) << fineBits) - 1);
+        std::vector<size_t> fine((size_t(1) << fineBits) + 1);
+        for (size_t c = 0; c + 1 < offsets.size(); ++c) {
+            const size_t begin = offsets[c], end = offsets[c + 1];
+            std::fill(fine.begin(), fine.end(), 0);
+            for (size_t i = begin; i < end; ++i) ++fine[(keyIds[i] & fineMask) + 1];
+            for (size_t f = 1; f < fine.size(); ++f) fine[f] += fine[f - 1];
+            for (size_t i = begin; i < end; ++i) arr[begin + fine[keyIds[i] & fineMask]++] = keys[i];
+            // fine[f] now ends bucket f
+            for (size_t f = 0, from = begin; f + 1 < fine.size(); ++f) {
+                const size_t to = begin + fine[f];
+                fixUp(arr.data() + from, to - from);
+                from = to;
+            }
+        }
+        return buckets;
+    }
+
+    static void fixUp(T* a, size_t count) {
+        std::less<T> comp;
+        if (count <= kInsertionLimit) {
+            detail::insertionSort(a, count, comp);
+        } else if (!MergeSort<T>::isSorted(a, count)) {
+            MergeSort<T>::sort(a, count);
+        }
+    }
+
+    static constexpr size_t kMinLearned = size_t(1) << 12;  ///< below this MergeSort is used directly
+    static constexpr size_t kSegments = 256;
+    static constexpr size_t kSampleDivisor = 64;
+    static constexpr size_t kMinSample = 2048;
+    static constexpr size_t kMaxSample = size_t(1) << 16;
+    static constexpr size_t kBucketFill = 8;
+    static constexpr size_t kCoarseBits = 10;
+    static constexpr size_t kInsertionLimit = 64;
+    static constexpr size_t kOverflowFactor = 8;
+    static constexpr double kMaxOverflowShare = 0.25;
+};
+
+template<typename T>
+LearnedSortReport learnedSort(std::vector<T>& arr) {
+    return LearnedSort<T>::sort(arr);
+}
+
+} // namespace sorting
+
+/**
+ * @brief Utility functions for demonstration
+ */
+class MergeSortDemo {
+public:
+    template<typename Container>
+    static void printContainer(const Container& cont) {
+        for (size_t i = 0; i < cont.size(); ++i) {
+            std::cout << cont[i] << (i + 1 == cont.size() ? "" : ", ");
+        }
+        std::cout << "\n";
+    }
+};
+
+/**
+ * @brief Benchmarks comparing sorting engines on generated data
+ */
+class MergeSortBenchmark {
+public:
+    static std::vector<long long> randomData(size_t count, uint64_t seed = 42) {
+        std::mt19937_64 rng(seed);
+        std::vector<long long> data(count);
+        for (auto& v : data) v = static_cast<long long>(rng());
+        return data;
+    }
+
+    static std::vector<long long> normalData(size_t count, uint64_t seed = 42) {
+        std::mt19937_64 rng(seed);
+        std::normal_distribution<double> normal(0.0, 1e12);
+        std::vector<long long> data(count);
+        for (auto& v : data) v = static_cast<long long>(normal(rng));
+        return data;
+    }
+
+    /**
+     * @brief Ranks 1..2^20 drawn with probability proportional to 1 / rank^1.1
+     */
+    static std::vector<long long> zipfData(size_t count, uint64_t seed = 42) {
+        std::vector<double> cumulative(size_t(1) << 20);
+        double total = 0;
+        for (size_t r = 0; r < cumulative.size(); ++r) cumulative[r] = total += std::pow(double(r + 1), -1.1);
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<double> uniform(0.0, total);
+        std::vector<long long> data(count);
+        for (auto& v : data) {
+            v = 1 + (std::upper_bound(cumulative.begin(), cumulative.end(), uniform(rng)) - cumulative.begin());
+        }
+        return data;
+    }
+
+    template<typename Fn>
+    static double timeMs(Fn fn) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(stop - start).count();
+    }
+
+    /**
+     * @brief 2-way MergeSort vs 4-way QuadMergeSort; the default size is twice the LLC
+     */
+    static void runQuadMerge(size_t count) {
+        if (count == 0) count = std::max<size_t>(2 * sorting::detail::lastLevelCacheBytes() / sizeof(long long), 1 << 20);
+        const std::vector<long long> input = randomData(count);
+        size_t twoWayPasses = 0;
+        while ((size_t(1) << twoWayPasses) < count) ++twoWayPasses;
+
+        std::cout << "Elements: " << count << " (" << (count * sizeof(long long) >> 20) << " MiB, LLC "
+                  << (sorting::detail::lastLevelCacheBytes() >> 20) << " MiB)\n";
+
+        std::vector<long long> data = input;
+        const double twoWayMs = timeMs([&]() { sorting::mergeSort(data); });
+        report("2-way MergeSort", twoWayMs, twoWayPasses, data);
+
+        data = input;
+        const double quadMs = timeMs([&]() { sorting::quadMergeSort(data); });
+        report("4-way QuadMergeSort", quadMs, sorting::QuadMergeSort<long long>::passCount(count), data);
+    }
+
+    /**
+     * @brief Sliding median over count values: SortedWindow vs re-sorting every window
+     */
+    static void runWindow(size_t count, size_t window) {
+        if (count == 0) count = 20000;
+        const std::vector<long long> input = randomData(count);
+        std::cout << "Values: " << count << ", window: " << window << "\n";
+
+        // Wrapping checksums of the medians; full-range values would overflow a signed sum
+        uint64_t treeSum = 0;
+        const double treeMs = timeMs([&]() {
+            sorting::SortedWindow<long long> sorted(window);
+            for (long long v : input) {
+                sorted.push(v);
+                treeSum += static_cast<uint64_t>(sorted.median());
+            }
+        });
+
+        uint64_t resortSum = 0;
+        const double resortMs = timeMs([&]() {
+            std::deque<long long> recent;
+            std::vector<long long> scratch;
+            for (long long v : input) {
+                recent.push_back(v);
+                if (recent.size() > window) recent.pop_front();
+                scratch.assign(recent.begin(), recent.end());
+                sorting::mergeSort(scratch);
+                resortSum += static_cast<uint64_t>(scratch[(scratch.size() - 1) / 2]);
+            }
+        });
+
+        std::cout << "  SortedWindow: " << treeMs << " ms (" << treeMs * 1e6 / count << " ns per median)\n"
+                  << "  re-sort each window: " << resortMs << " ms (" << resortMs * 1e6 / count
+                  << " ns per median)" << (treeSum == resortSum ? "" : " [MISMATCH]") << "\n";
+    }
+
+    /**
+     * @brief Lower bounds of random keys: std::lower_bound vs EytzingerIndex, single and batched
+     */
+    static void runSearch(size_t count) {
+        if (count == 0) count = std::max<size_t>(2 * sorting::detail::lastLevelCacheBytes() / sizeof(long long), 1 << 20);
+        std::vector<long long> sorted = randomData(count);
+        sorting::quadMergeSort(sorted);
+        const std::vector<long long> keys = randomData(size_t(1) << 21, 7);
+        std::cout << "Values: " << count << " (" << (count * sizeof(long long) >> 20) << " MiB), queries: "
+                  << keys.size() << "\n";
+
+        std::vector<size_t> expected(keys.size());
+        const double binaryMs = timeMs([&]() {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                expected[i] = static_cast<size_t>(std::lower_bound(sorted.begin(), sorted.end(), keys[i]) - sorted.begin());
+            }
+        });
+        const sorting::EytzingerIndex<long long> index(sorted);
+        std::vector<size_t> single(keys.size());
+        const double singleMs = timeMs([&]() {
+            for (size_t i = 0; i < keys.size(); ++i) single[i] = index.lowerBound(keys[i]);
+        });
+        std::vector<size_t> batched;
+        const double batchedMs = timeMs([&]() { batched = index.lowerBound(keys); });
+
+        auto line = [&](const char* name, double ms, bool ok) {
+            std::cout << "  " << name << ": " << ms << " ms (" << ms * 1e6 / keys.size() << " ns per query)"
+                      << (ok ? "" : " [MISMATCH]") << "\n";
+        };
+        line("std::lower_bound", binaryMs, true);
+        line("Eytzinger", singleMs, single == expected);
+        line("Eytzinger batched", batchedMs, batched == expected);
+    }
+
+    /**
+     * @brief MergeSort, QuadMergeSort and LearnedSort on uniform, normal and Zipf keys
+     */
+    static void runLearned(size_t count) {
+        if (count == 0) count = size_t(1) << 22;
+        std::cout << "Elements: " << count << "\n";
+        const std::pair<const char*, std::vector<long long>> inputs[] = {
+            {"uniform", randomData(count)},
+            {"normal", normalData(count)},
+            {"zipf", zipfData(count)},
+        };
+        for (const auto& input : inputs) {
+            std::cout << input.first << ":\n";
+            std::vector<long long> expected = input.second;
+            const double mergeMs = timeMs([&]() { sorting::mergeSort(expected); });
+            std::vector<long long> data = input.second;
+            const double quadMs = timeMs([&]() { sorting::quadMergeSort(data); });
+            const bool quadOk = data == expected;
+            data = input.second;
+            sorting::LearnedSortReport report;
+            const double learnedMs = timeMs([&]() { report = sorting::learnedSort(data); });
+
+            std::cout << "  MergeSort: " << mergeMs << " ms\n"
+                      << "  QuadMergeSort: " << quadMs << " ms" << (quadOk ? "" : " [MISMATCH]") << "\n"
+                      << "  LearnedSort: " << learnedMs << " ms ("
+                      << (report.usedModel ? "model, " : "fell back to MergeSort, ") << report.segments
+                      << " segments, " << report.buckets << " buckets, " << report.overflowShare * 100
+                      << "% overflow)" << (data == expected ? "" : " [MISMATCH]") << "\n";
+        }
+    }
+
+    /**
+     * @brief (key, row id) pairs: MergeSort with a pair comparator vs PairSort's packed words
+     */
+    static void runPairs(size_t count) {
+        if (count == 0) count = size_t(1) << 22;
+        std::cout << "Pairs: " << count << "\n";
+        runPairsOf<uint32_t>("32-bit keys, 64-bit words", count);
+        runPairsOf<int64_t>("64-bit keys, 128-bit words", count);
+    }
+
+    /**
+     * @brief 256-byte records: QuadMergeSort moving records vs MergeSort's automatic indirect
+     * mode vs indirectSort with a key prefix
+     */
+    static void runIndirect(size_t count) {
+        if (count == 0) count = size_t(1) << 18;
+        struct Record {
+            long long key;
+            char payload[248];
+        };
+        const std::vector<long long> keys = randomData(count);
+        std::vector<Record> input(count);
+        for (size_t i = 0; i < count; ++i) {
+            input[i].key = keys[i];
+            std::memset(input[i].payload, static_cast<int>(i), sizeof(input[i].payload));
+        }
+        const auto byKey = [](const Record& a, const Record& b) { return a.key < b.key; };
+        std::cout << "Records: " << count << " x " << sizeof(Record) << " bytes (" << (count * sizeof(Record) >> 20)
+                  << " MiB)\n";
+
+        std::vector<Record> expected = input;
+        const double directMs = timeMs([&]() { sorting::quadMergeSort(expected, byKey); });
+        auto same = [&](const std::vector<Record>& data) {
+            for (size_t i = 0; i < count; ++i) {
+                if (data[i].key != expected[i].key || data[i].payload[0] != expected[i].payload[0]) return false;
+            }
+            return true;
+        };
+        std::vector<Record> data = input;
+        const double indirectMs = timeMs([&]() { sorting::mergeSort(data, byKey); });
+        const bool indirectOk = same(data);
+        data = input;
+        const double prefixMs = timeMs([&]() {
+            sorting::indirectSort(data, [](const Record& r) { return r.key; }, byKey);
+        });
+        std::cout << "  QuadMergeSort, moving records: " << directMs << " ms\n"
+                  << "  MergeSort, automatic indirect: " << indirectMs << " ms" << (indirectOk ? "" : " [MISMATCH]")
+                  << "\n"
+                  << "  indirectSort with key prefix: " << prefixMs << " ms" << (same(data) ? "" : " [MISMATCH]")
+                  << "\n";
+    }
+
+    /**
+     * @brief mergeSort under the seq and par policies, on a pool started per call and on a shared ThreadPool
+     */
+    static void runParallel(size_t count, size_t threads) {
+        if (count == 0) count = size_t(1) << 22;
+        const std::vector<long long> input = randomData(count);
+        sorting::ThreadPool pool(threads);
+        std::cout << "Elements: " << count << ", pool threads: " << pool.concurrency() << "\n";
+
+        std::vector<long long> expected = input;
+        const double seqMs = timeMs([&]() { sorting::mergeSort(sorting::execution::seq, expected); });
+        std::cout << "  seq: " << seqMs << " ms\n";
+        std::vector<long long> data = input;
+        sorting::ParallelSortReport report;
+        const double parMs = timeMs([&]() { report = sorting::mergeSort(sorting::execution::par, data); });
+        std::cout << "  par, pool per call: " << parMs << " ms, " << usage(report)
+                  << (data == expected ? "" : " [MISMATCH]") << "\n";
+        data = input;
+        const double poolMs = timeMs([&]() { report = sorting::mergeSort(sorting::execution::par.on(pool), data); });
+        std::cout << "  par.on(ThreadPool): " << poolMs << " ms, " << usage(report)
+                  << (data == expected ? "" : " [MISMATCH]") << "\n";
+    }
+
+    /**
+     * @brief QuadMergeSort with cached vs streaming stores, alone and next to a
+     * cache-sensitive workload (pointer chasing through half the LLC)
+     */
+    static void runStream(size_t count) {
+        const size_t llc = sorting::detail::lastLevelCacheBytes();
+        if (count == 0) count = std::max<size_t>(2 * llc / sizeof(long long), 1 << 20);
+        const std::vector<long long> input = randomData(count);
+        std::cout << "Elements: " << count << " (" << (count * sizeof(long long) >> 20) << " MiB, LLC " << (llc >> 20)
+                  << " MiB)" << (sorting::detail::canStreamStore<long long>() ? "" : ", streaming stores unavailable")
+                  << "\n";
+
+        // One random cycle (Sattolo's algorithm), so every load depends on the previous one
+        std::vector<uint32_t> next(std::max<size_t>(llc / 2 / sizeof(uint32_t), 2));
+        for (size_t i = 0; i < next.size(); ++i) next[i] = static_cast<uint32_t>(i);
+        std::mt19937_64 rng(1);
+        for (size_t i = next.size() - 1; i > 0; --i) std::swap(next[i], next[rng() % i]);
+        auto chaseRate = [&](const std::function<void()>& alongside) {
+            std::atomic<bool> stop(false);
+            uint64_t steps = 0;
+            uint32_t at = 0;
+            const auto start = std::chrono::steady_clock::now();
+            std::thread chaser([&]() {
+                while (!stop.load(std::memory_order_relaxed)) {
+                    for (int i = 0; i < 1024; ++i) at = next[at];
+                    steps += 1024;
+                }
+            });
+            alongside();
+            stop = true;
+            chaser.join();
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return at == next.size() ? 0.0 : steps / ms;  // reading `at` keeps the chase from being optimized out
+        };
+        const double soloRate = chaseRate([]() { std::this_thread::sleep_for(std::chrono::milliseconds(500)); });
+        std::cout << "  workload alone: " << soloRate << " loads/ms\n";
+
+        for (const auto hint : {sorting::StoreHint::Cached, sorting::StoreHint::Streaming}) {
+            const char* name = hint == sorting::StoreHint::Cached ? "cached stores" : "streaming stores";
+            std::vector<long long> data = input;
+            const double ms = timeMs([&]() { sorting::quadMergeSort(data, std::less<long long>(), hint); });
+            report(name, ms, sorting::QuadMergeSort<long long>::passCount(count), data);
+
+            data = input;
+            double sharedMs = 0;
+            const double rate = chaseRate([&]() {
+                sharedMs = timeMs([&]() { sorting::quadMergeSort(data, std::less<long long>(), hint); });
+            });
+            std::cout << "    next to the workload: sort " << sharedMs << " ms, workload " << rate << " loads/ms ("
+                      << rate * 100 / soloRate << "% of alone)\n";
+        }
+    }
+
+private:
+    static std::string usage(const sorting::ParallelSortReport& report) {
+        std::string text = std::to_string(report.peakThreads) + " at once, " + std::to_string(report.threads) +
+                           " threads on " + std::to_string(report.cores) + " cores";
+        if (report.cpus.empty()) return text;
+        for (size_t i = 0; i < report.cpus.size(); ++i) text += (i ? "," : " (CPU ") + std::to_string(report.cpus[i]);
+        return text + ")";
+    }
+
+    template<typename K>
+    static void runPairsOf(const char* name, size_t count) {
+        const std::vector<long long> keys = randomData(count);
+        std::vector<std::pair<K, uint32_t>> input(count);
+        for (size_t i = 0; i < count; ++i) input[i] = {static_cast<K>(keys[i]), static_cast<uint32_t>(i)};
+        std::cout << name << ":\n";
+
+        const auto byKey = [](const std::pair<K, uint32_t>& a, const std::pair<K, uint32_t>& b) {
+            return a.first < b.first;
+        };
+        std::vector<std::pair<K, uint32_t>> expected = input;
+        const double mergeMs = timeMs([&]() { sorting::mergeSort(expected, byKey); });
+        std::cout << "  MergeSort<pair>: " << mergeMs << " ms\n";
+        // MergeSort does not keep equal keys in input order; the stable 4-way merge is the reference
+        expected = input;
+        const double quadMs = timeMs([&]() { sorting::quadMergeSort(expected, byKey); });
+        std::cout << "  QuadMergeSort<pair>: " << quadMs << " ms\n";
+        for (const auto kernel : {sorting::PairKernel::Merge, sorting::PairKernel::Radix}) {
+            std::vector<std::pair<K, uint32_t>> data = input;
+            const double ms = timeMs([&]() { sorting::pairSort(data, sorting::SortOrder::Ascending, kernel); });
+            std::cout << "  PairSort " << (kernel == sorting::PairKernel::Radix ? "radix" : "merge") << ": " << ms
+                      << " ms" << (data == expected ? "" : " [MISMATCH]") << "\n";
+        }
+    }
+
+    static void report(const char* name, double ms, size_t passes, const std::vector<long long>& data) {
+        const bool ok = sorting::MergeSort<long long>::isSorted(data.data(), data.size());
+        std::cout << "  " << name << ": " << ms << " ms, " << passes << " merge passes"
+                  << (ok ? "" : " [NOT SORTED]") << "\n";
+    }
+};
+
+/**
+ * @brief Non-interactive command-line modes
+ */
+class CommandLine {
+public:
+    static int run(int argc, char* argv[]) {
+        const std::vector<std::string> args(argv + 1, argv + argc);
+        if (args[0] == "--help" || args[0] == "-h") {
+            printUsage();
+            return 0;
+        }
+        applyConcurrencyLimits(args);
+        if (args[0] == "--bench" && args.size() >= 2) {
+            const size_t count = args.size() >= 3 && args[2].compare(0, 2, "--") != 0 ? parseCount(args[2]) : 0;
+            if (args[1] == "quad") {
+                MergeSortBenchmark::runQuadMerge(count);
+                return 0;
+            }
+            if (args[1] == "indirect") {
+                MergeSortBenchmark::runIndirect(count);
+                return 0;
+            }
+            if (args[1] == "learned") {
+                MergeSortBenchmark::runLearned(count);
+                return 0;
+            }
+            if (args[1] == "parallel") {
+                MergeSortBenchmark::runParallel(count, sizeOption(args, "--threads", 0));
+                return 0;
+            }
+            if (args[1] == "pairs") {
+                MergeSortBenchmark::runPairs(count);
+                return 0;
+            }
+            if (args[1] == "stream") {
+                MergeSortBenchmark::runStream(count);
+                return 0;
+            }
+            if (args[1] == "search") {
+                MergeSortBenchmark::runSearch(count);
+                return 0;
+            }
+            if (args[1] == "window") {
+                MergeSortBenchmark::runWindow(count, sizeOption(args, "--window", 1000));
+                return 0;
+            }
+        }
+        if (args[0] == "--pipeline") return runPipeline(args);
+        if (args[0] == "--input" && args.size() >= 2) return runParallelFile(args);
+        if (args[0] == "--external") return runExternal(args);
+        if (args[0] == "--bounded") return runBounded(args);
+        if (args[0] == "--top-k" && args.size() >= 2) return runTopK(args);
+        if (args[0] == "--quantiles") return runQuantiles(args);
+        printUsage();
+        return 1;
+    }
+
+private:
+    /**
+     * @brief Sorts integers from stdin, sorting fixed-size chunks while parsing continues
+     */
+    static int runPipeline(const std::vector<std::string>& args) {
+        const size_t chunkSize = sizeOption(args, "--chunk", size_t(1) << 16);
+        const size_t threads = sizeOption(args, "--threads", 0);
+        const auto start = std::chrono::steady_clock::now();
+
+        sorting::ChunkedSorter<long long> sorter(chunkSize, threads);
+        size_t count = 0;
+        forEachInput(stringOption(args, "--in-format", "text"), stdin, [&](long long value) {
+            sorter.push(value);
+            ++count;
+        });
+        const auto parsed = std::chrono::steady_clock::now();
+        const size_t chunks = (count + chunkSize - 1) / chunkSize;
+        const std::vector<long long> sorted = sorter.finish();
+        const auto merged = std::chrono::steady_clock::now();
+
+        writeOutput(stringOption(args, "--out-format", "text"), stdout, sorted);
+
+        std::cerr << "Sorted " << count << " values in " << chunks << " chunks: input parsed after "
+                  << std::chrono::duration<double, std::milli>(parsed - start).count() << " ms, merged after "
+                  << std::chrono::duration<double, std::milli>(merged - start).count() << " ms\n";
+        return 0;
+    }
+
+    /**
+     * @brief Maps a text file, parses and sorts separator-aligned pieces per thread, then merges
+     */
+    static int runParallelFile(const std::vector<std::string>& args) {
+        size_t threads = sizeOption(args, "--threads", 0);
+        if (threads == 0) threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        const auto start = std::chrono::steady_clock::now();
+
+        const sorting::io::MappedFile file(args[1]);
+        const std::vector<size_t> bounds = sorting::io::splitAtSeparators(file.data(), file.size(), threads);
+        std::vector<std::vector<long long>> runs(threads);
+        sorting::detail::parallelFor(threads, [&](size_t i) {
+            runs[i].reserve((bounds[i + 1] - bounds[i]) / 8);
+            sorting::io::parseRange(file.data() + bounds[i], file.data() + bounds[i + 1], runs[i]);
+            sorting::quadMergeSort(runs[i]);
+        });
+        const auto sortedRuns = std::chrono::steady_clock::now();
+        const std::vector<long long> sorted = sorting::mergeRuns(runs);
+        const auto merged = std::chrono::steady_clock::now();
+
+        writeOutput(stringOption(args, "--out-format", "text"), stdout, sorted);
+
+        std::cerr << "Sorted " << sorted.size() << " values from " << (file.size() >> 20) << " MiB on "
+                  << threads << " threads: parse+sort " << std::chrono::duration<double, std::milli>(sortedRuns - start).count()
+                  << " ms, merge " << std::chrono::duration<double, std::milli>(merged - sortedRuns).count() << " ms\n";
+        return 0;
+    }
+
+    /**
+     * @brief Runs fn with a reader for the given input format ("text" or "binary")
+     */
+    template<typename Fn>
+    static void withInputReader(const std::string& format, std::FILE* file, Fn fn) {
+        if (format == "text") {
+            sorting::io::TextReader<long long> reader(file);
+            fn(reader);
+        } else if (format == "binary") {
+            sorting::io::BinaryReader<long long> reader(file);
+            fn(reader);
+        } else {
+            throw std::invalid_argument("Unknown input format '" + format + "' (expected text or binary)");
+        }
+    }
+
+    /**
+     * @brief Calls fn for every value read from file in the given format
+     */
+    template<typename Fn>
+    static void forEachInput(const std::string& format, std::FILE* file, Fn fn) {
+        withInputReader(format, file, [&](auto& reader) {
+            long long value;
+            while (reader.next(value)) fn(value);
+        });
+    }
+
+    /**
+     * @brief Runs fn with a writer for ascending output as "text", "raw", "delta" or "packed"
+     */
+    template<typename Fn>
+    static void withOutputWriter(const std::string& format, std::FILE* file, uint64_t count, Fn fn) {
+        if (format == "text") {
+            sorting::io::TextWriter<long long> writer(file);
+            fn(writer);
+            writer.flush();
+        } else {
+            sorting::io::BinaryWriter<long long> writer(file, parseEncoding(format), true, count);
+            fn(writer);
+            writer.finish();
+        }
+    }
+
+    static void writeOutput(const std::string& format, std::FILE* file, const std::vector<long long>& sorted) {
+        withOutputWriter(format, file, sorted.size(), [&](auto& writer) {
+            for (long long v : sorted) writer.write(v);
+        });
+    }
+
+    static sorting::io::Encoding parseEncoding(const std::string& name) {
+        if (name == "raw") return sorting::io::Encoding::Raw;
+        if (name == "delta") return sorting::io::Encoding::DeltaVarint;
+        if (name == "packed") return sorting::io::Encoding::BlockPacked;
+        throw std::invalid_argument("Unknown format '" + name + "' (expected text, raw, delta or packed)");
+    }
+
+    static std::string stringOption(const std::vector<std::string>& args, const std::string& name,
+                                    const std::string& fallback) {
+        for (size_t i = 0; i + 1 < args.size(); ++i) {
+            if (args[i] == name) return args[i + 1];
+        }
+        return fallback;
+    }
+
+    /**
+     * @brief Sorts stdin with ExternalSort, spilling compressed runs, and reports spill statistics
+     */
+    static int runExternal(const std::vector<std::string>& args) {
+        sorting::ExternalSortOptions options;
+        options.memoryBudget = sizeOption(args, "--memory", options.memoryBudget);
+        options.tempDirectory = stringOption(args, "--temp", "");
+        options.runEncoding = parseEncoding(stringOption(args, "--run-format", "packed"));
+        options.mergeFanIn = sizeOption(args, "--fan-in", options.mergeFanIn);
+        options.jobDirectory = stringOption(args, "--job", "");
+        options.sortThreads = sizeOption(args, "--sort-threads", options.sortThreads);
+        const std::string backend = stringOption(args, "--io", "stdio");
+        if (backend == "direct") {
+            options.ioBackend = sorting::io::IoBackend::Direct;
+        } else if (backend != "stdio") {
+            throw std::invalid_argument("Unknown I/O backend '" + backend + "' (expected stdio or direct)");
+        }
+        const std::string runs = stringOption(args, "--runs", "chunks");
+        if (runs == "replacement") {
+            options.runGeneration = sorting::RunGeneration::ReplacementSelection;
+        } else if (runs != "chunks") {
+            throw std::invalid_argument("Unknown run generation '" + runs + "' (expected chunks or replacement)");
+        }
+
+        sorting::ExternalSort<long long> sorter(options);
+        withInputReader(stringOption(args, "--in-format", "text"), stdin, [&](auto& reader) {
+            withOutputWriter(stringOption(args, "--out-format", "text"), stdout,
+                             sorting::io::BinaryHeader::kUnknownCount,
+                             [&](auto& writer) { sorter.sort(reader, writer); });
+        });
+
+        const sorting::ExternalSortStats& stats = sorter.stats();
+        const double seconds = (stats.runFormationMs + stats.mergeMs) / 1000.0;
+        std::cerr << "Sorted " << stats.values << " values: " << stats.runs << " runs, " << stats.mergePasses
+                  << " merge passes\n";
+        if (stats.longestRun > 0) {
+            std::cerr << "  run length: shortest " << stats.shortestRun << ", average " << stats.averageRunLength()
+                      << ", longest " << stats.longestRun << " values\n";
+        }
+        if (stats.resumedRuns > 0) {
+            std::cerr << "  resumed " << stats.resumedRuns << " checkpointed runs covering " << stats.skippedValues
+                      << " input values\n";
+        }
+        std::cerr
+                  << "  peak memory " << (stats.peakMemoryBytes >> 10) << " KiB, run I/O via " << stats.ioBackend << "\n"
+                  << "  spilled " << (stats.spilledBytes >> 10) << " KiB for " << (stats.rawSpillBytes >> 10)
+                  << " KiB of values (compression " << stats.compressionRatio() << "x)\n"
+                  << "  run formation " << stats.runFormationMs << " ms, merge " << stats.mergeMs << " ms, "
+                  << (seconds > 0 ? stats.values * sizeof(long long) / seconds / (1 << 20) : 0.0) << " MiB/s\n";
+        return 0;
+    }
+
+    /**
+     * @brief Sorts stdin in memory under --memory-limit and reports the chosen strategy
+     */
+    static int runBounded(const std::vector<std::string>& args) {
+        sorting::MergeSortOptions options;
+        options.memoryLimit = sizeOption(args, "--memory-limit", 0);
+        options.spillDirectory = stringOption(args, "--spill", "");
+
+        std::vector<long long> data;
+        forEachInput(stringOption(args, "--in-format", "text"), stdin, [&](long long value) { data.push_back(value); });
+        const auto start = std::chrono::steady_clock::now();
+        const sorting::MergeSortReport report = sorting::mergeSort(data, options);
+        const auto sorted = std::chrono::steady_clock::now();
+
+        writeOutput(stringOption(args, "--out-format", "text"), stdout, data);
+
+        std::cerr << "Sorted " << data.size() << " values with the " << sorting::toString(report.strategy)
+                  << " strategy: peak scratch " << report.peakBytes << " bytes, "
+                  << std::chrono::duration<double, std::milli>(sorted - start).count() << " ms\n";
+        return 0;
+    }
+
+    /**
+     * @brief Streams stdin through StreamingTopK, printing the top k (greatest first) every N
+     * values with --every N and once more when the input ends
+     */
+    static int runTopK(const std::vector<std::string>& args) {
+        sorting::StreamingTopK<long long> topK(parseCount(args[1]));
+        const size_t every = sizeOption(args, "--every", 0);
+        sorting::io::TextWriter<long long> writer(stdout);
+        auto emit = [&]() {
+            for (long long v : topK.top()) writer.write(v);
+            writer.flush();
+            std::fputc('\n', stdout);
+            std::fflush(stdout);
+        };
+        forEachInput(stringOption(args, "--in-format", "text"), stdin, [&](long long value) {
+            topK.push(value);
+            if (every > 0 && topK.seen() % every == 0) emit();
+        });
+        emit();
+        std::cerr << "Kept the top " << std::min<uint64_t>(topK.k(), topK.seen()) << " of " << topK.seen() << " values\n";
+        return 0;
+    }
+
+    /**
+     * @brief Streams stdin into a KllSketch and prints the requested quantiles, every N values
+     * with --every N and once more when the input ends
+     */
+    static int runQuantiles(const std::vector<std::string>& args) {
+        size_t k = 200;
+        if (sizeOption(args, "--sketch-kb", 0) > 0) {
+            k = sorting::KllSketch<long long>::kForMemory(sizeOption(args, "--sketch-kb", 0) << 10);
+        } else if (!stringOption(args, "--error", "").empty()) {
+            k = sorting::KllSketch<long long>::kForError(std::stod(stringOption(args, "--error", "")));
+        }
+        std::vector<double> qs;
+        std::stringstream list(stringOption(args, "--q", "0.5,0.9,0.99"));
+        for (std::string item; std::getline(list, item, ',');) qs.push_back(std::stod(item));
+        const size_t every = sizeOption(args, "--every", 0);
+
+        sorting::KllSketch<long long> sketch(k);
+        auto emit = [&]() {
+            if (sketch.count() == 0) return;
+            for (double q : qs) std::cout << "q" << q << " " << sketch.quantile(q) << "\n";
+            std::cout << std::endl;
+        };
+        forEachInput(stringOption(args, "--in-format", "text"), stdin, [&](long long value) {
+            sketch.update(value);
+            if (every > 0 && sketch.count() % every == 0) emit();
+        });
+        emit();
+        std::cerr << "Sketched " << sketch.count() << " values with k=" << k << ": " << sketch.retained()
+                  << " retained, " << (sketch.memoryBytes() + 1023) / 1024 << " KiB, rank error about +/-"
+                  << sketch.normalizedRankError() * 100 << "%\n";
+        return 0;
+    }
+
+    static size_t sizeOption(const std::vector<std::string>& args, const std::string& name, size_t fallback) {
+        for (size_t i = 0; i + 1 < args.size(); ++i) {
+            if (args[i] == name) return parseCount(args[i + 1]);
+        }
+        return fallback;
+    }
+
+    /**
+     * @brief Sets the global limits from --max-threads N, --cpus LIST and --idle-siblings
+     */
+    static void applyConcurrencyLimits(const std::vector<std::string>& args) {
+        sorting::ConcurrencyLimits limits;
+        limits.maxThreads = sizeOption(args, "--max-threads", 0);
+        limits.idleSiblings = std::find(args.begin(), args.end(), "--idle-siblings") != args.end();
+        // CPU list in the taskset format, e.g. "0-3,8"
+        std::stringstream list(stringOption(args, "--cpus", ""));
+        for (std::string range; std::getline(list, range, ',');) {
+            const size_t dash = range.find('-');
+            const size_t first = parseCount(range.substr(0, dash));
+            const size_t last = dash == std::string::npos ? first : parseCount(range.substr(dash + 1));
+            if (first > last) throw std::invalid_argument("CPU range '" + range + "' is reversed");
+            if (last >= static_cast<size_t>(sorting::detail::kMaxCpus)) {
+                throw std::invalid_argument("CPU id " + std::to_string(last) + " in '" + range + "' is not below " +
+                                            std::to_string(sorting::detail::kMaxCpus));
+            }
+            for (size_t cpu = first; cpu <= last; ++cpu) limits.cpus.push_back(static_cast<int>(cpu));
+        }
+        sorting::setConcurrencyLimits(limits);
+    }
+
+    static size_t parseCount(const std::string& text) {
+        if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+            throw std::invalid_argument("Expected a non-negative count, got '" + text + "'");
+        }
+        return static_cast<size_t>(std::stoull(text));
+    }
+
+    static void printUsage() {
+        std::cout << "Usage:\n"
+                  << "  mergesort                      interactive demo\n"
+                  << "  mergesort --bench quad [N]     2-way vs 4-way merge sort on N random values\n"
+                  << "  mergesort --bench indirect [N] 256-byte records: moving records vs indirect sort\n"
+                  << "  mergesort --bench learned [N]  merge sorts vs learned sort on uniform, normal, Zipf data\n"
+                  << "  mergesort --bench parallel [N] [--threads N]\n"
+                  << "                                 mergeSort with seq and par policies, per-call pool vs a shared one\n"
+                  << "  mergesort --bench pairs [N]    (key, row id) pairs: comparator merge sort vs packed words\n"
+                  << "  mergesort --bench search [N]   lower bounds: binary search vs Eytzinger layout\n"
+                  << "  mergesort --bench stream [N]   QuadMergeSort with cached vs non-temporal stores, alone\n"
+                  << "                                 and next to a cache-sensitive workload\n"
+                  << "  mergesort --bench window [N] [--window W]\n"
+                  << "                                 sliding median: SortedWindow vs re-sorting each window\n"
+                  << "  mergesort --pipeline [--chunk N] [--threads N] [--in-format text|binary]\n"
+                  << "                                 sort stdin, overlapping parsing with chunk sorts\n"
+                  << "  mergesort --input FILE [--threads N]\n"
+                  << "                                 map FILE and parse/sort it on N threads\n"
+                  << "  mergesort --external [--memory BYTES] [--run-format raw|delta|packed] [--fan-in N] [--temp DIR]\n"
+                  << "                       [--job DIR] [--runs chunks|replacement] [--sort-threads N]\n"
+                  << "                       [--io stdio|direct]\n"
+                  << "                                 sort stdin through compressed on-disk runs;\n"
+                  << "                                 with --job, checkpoint to DIR and resume after a crash;\n"
+                  << "                                 --runs replacement forms runs by replacement selection;\n"
+                  << "                                 --sort-threads N overlaps reading, N sorters and writing;\n"
+                  << "                                 --io direct uses O_DIRECT through io_uring (or pread/pwrite)\n"
+                  << "  mergesort --bounded [--memory-limit BYTES] [--spill DIR]\n"
+                  << "                                 sort stdin keeping merge scratch under BYTES\n"
+                  << "  mergesort --top-k K [--every N] [--in-format text|binary]\n"
+                  << "                                 stream stdin keeping the K greatest values; print them\n"
+                  << "                                 every N values and at the end\n"
+                  << "  mergesort --quantiles [--q 0.5,0.9,...] [--error E | --sketch-kb N] [--every N]\n"
+                  << "                                 approximate quantiles of stdin from a KLL sketch\n"
+                  << "Output options: --out-format text|raw|delta|packed (all but text use the binary format)\n"
+                  << "Thread options: --max-threads N caps threads per sort, --cpus LIST (e.g. 0-3,8) pins workers,\n"
+                  << "                --idle-siblings uses one hardware thread per core\n";
+    }
+};
+
+/**
+ * @brief Main function with interactive user input + professional demo
+ */
+int main(int argc, char* argv[]) {
+    try {
+        if (argc > 1) return CommandLine::run(argc, argv);
+
         std::cout << "=========================================\n";
         std::cout << "           PROFESSIONAL MERGESORT         \n";
         std::cout << "=========================================\n";
@@ -127,6 +5995,8 @@ int main() {
         std::cout << "GitHub : https://github.com/Allanelh\n";
         std::cout << "License: MIT\n\n";
 
+        // Repeating a batch in the loop below is answered from the cache
+        sorting::SortCache<long long> cache;
         char runAgain = 'Y';
         while (std::toupper(runAgain) == 'Y') {
             std::cout << "Enter integers separated by spaces or commas:\n";
@@ -152,9 +6022,9 @@ int main() {
                 std::cout << "\nInput Data: ";
                 MergeSortDemo::printContainer(data);
 
-                sorting::mergeSort(data);
+                const bool cachedAscending = cache.sort(data);
 
-                std::cout << "Sorted Data (Ascending): ";
+                std::cout << "Sorted Data (Ascending" << (cachedAscending ? ", cached" : "") << "): ";
                 MergeSortDemo::printContainer(data);
 
                 if (sorting::MergeSort<long long>::isSorted(data.data(), data.size())) {
@@ -168,8 +6038,8 @@ int main() {
                     bool operator()(long long a, long long b) const { return a > b; }
                 };
 
-                sorting::mergeSort(data, DescendingComparator());
-                std::cout << "\nSorted Data (Descending): ";
+                const bool cachedDescending = cache.sort(data, DescendingComparator());
+                std::cout << "\nSorted Data (Descending" << (cachedDescending ? ", cached" : "") << "): ";
                 MergeSortDemo::printContainer(data);
                 std::cout << "Descending sort verified.\n";
             }
@@ -180,6 +6050,8 @@ int main() {
             std::cout << "\n";
         }
 
+        const sorting::SortCacheStats& cacheStats = cache.stats();
+        std::cout << "Sort cache: " << cacheStats.hits << " hits, " << cacheStats.misses << " misses\n";
         std::cout << "Thank you for using Professional MergeSort. Exiting...\n";
         return 0;
 